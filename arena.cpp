@@ -0,0 +1,69 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Nodes allocated from arenas (see Node::operator new)
+
+#include "tree.h"
+
+thread_local Arena* current_arena = 0;
+
+void destroy_node(void* node) {
+  switch(((Node*)node)->type) {
+    case Class:
+      ((ClassNode*)node)->~ClassNode();
+      break;
+    case Scope:
+      ((ScopeNode*)node)->~ScopeNode();
+      break;
+    case VariableDeclaration:
+      ((VariableDeclarationNode*)node)->~VariableDeclarationNode();
+      break;
+    case Constant:
+      ((ConstantNode*)node)->~ConstantNode();
+      break;
+    case BinaryExpression:
+      ((BinaryExpressionNode*)node)->~BinaryExpressionNode();
+      break;
+    case VariableReference:
+      ((VariableReferenceNode*)node)->~VariableReferenceNode();
+      break;
+    case Goto:
+      ((GotoNode*)node)->~GotoNode();
+      break;
+    case Label:
+      ((LabelNode*)node)->~LabelNode();
+      break;
+    case UnaryExpression:
+      ((UnaryNode*)node)->~UnaryNode();
+      break;
+    case Function:
+      ((FunctionNode*)node)->~FunctionNode();
+      break;
+    case Alias:
+      ((AliasNode*)node)->~AliasNode();
+      break;
+    case FunctionCall:
+      ((FunctionCallNode*)node)->~FunctionCallNode();
+      break;
+    case IfStatement:
+      ((IfStatementNode*)node)->~IfStatementNode();
+      break;
+    case WhileStatement:
+      ((WhileStatementNode*)node)->~WhileStatementNode();
+      break;
+    case ReturnStatement:
+      ((ReturnStatementNode*)node)->~ReturnStatementNode();
+      break;
+    default:
+      ((Node*)node)->~Node();
+      break;
+  }
+}
@@ -0,0 +1,129 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef ARENA_HEADER
+#define ARENA_HEADER
+#include <stdlib.h>
+#include <new>
+#include <utility>
+#include <vector>
+
+class alignas(16) ArenaChunk {
+public:
+  ArenaChunk* next;
+  size_t size;
+  size_t used;
+  char* data() {
+    return (char*)(this+1);
+  }
+};
+
+//The compiler never frees its tree, so a Compiler allocates each program from an arena,
+//which is rewound before the next program is compiled. Chunks are kept for reuse.
+//While an arena is active on a thread, nodes created on that thread are allocated from it (see Node::operator new).
+//Other objects that live as long as the program are handed to the arena with own(). Everything is destroyed on reset.
+class Arena {
+public:
+  typedef void (*Finalizer)(void*);
+  ArenaChunk* head = 0;
+  ArenaChunk* current = 0; //Chunk being allocated from (0 if nothing has been allocated since the last reset)
+  bool active = false;
+  std::vector<std::pair<Finalizer,void*> > finalizers; //Objects to destroy on reset, in order of creation
+  void* allocate(size_t size) {
+    size = (size+15) & ~(size_t)15;
+    if(!current || current->used+size > current->size) {
+      //Chunks after current are unused, so the next one can be taken if it is big enough
+      ArenaChunk* next = current ? current->next : head;
+      if(!next || next->size < size) {
+	size_t chunkSize = size > 1024*1024 ? size : 1024*1024;
+	ArenaChunk* chunk = (ArenaChunk*)malloc(sizeof(ArenaChunk)+chunkSize);
+	if(!chunk) {
+	  throw std::bad_alloc();
+	}
+	chunk->size = chunkSize;
+	chunk->used = 0;
+	chunk->next = next;
+	if(current) {
+	  current->next = chunk;
+	}else {
+	  head = chunk;
+	}
+	next = chunk;
+      }
+      current = next;
+    }
+    void* rval = current->data()+current->used;
+    current->used+=size;
+    return rval;
+  }
+  template<typename T>
+  static void destroy(void* object) {
+    delete (T*)object;
+  }
+  //Destroys object (allocated with new) on reset
+  template<typename T>
+  T* own(T* object) {
+    finalize(destroy<T>,object);
+    return object;
+  }
+  void finalize(Finalizer finalizer, void* object) {
+    finalizers.push_back(std::make_pair(finalizer,object));
+  }
+  //Forgets an object that was destroyed early. Returns false if the arena doesn't own it.
+  //Objects are usually destroyed soon after they are created, so the search starts from the end.
+  bool release(void* object) {
+    for(size_t i = finalizers.size();i>0;i--) {
+      if(finalizers[i-1].second == object) {
+	finalizers.erase(finalizers.begin()+(i-1));
+	return true;
+      }
+    }
+    return false;
+  }
+  //Bytes allocated since the last reset
+  size_t size() {
+    size_t rval = 0;
+    for(ArenaChunk* i = head;i;i = i->next) {
+      rval+=i->used;
+    }
+    return rval;
+  }
+  void reset() {
+    //Objects can refer to the ones created before them
+    while(finalizers.size()) {
+      std::pair<Finalizer,void*> object = finalizers.back();
+      finalizers.pop_back();
+      object.first(object.second);
+    }
+    for(ArenaChunk* i = head;i;i = i->next) {
+      i->used = 0;
+    }
+    current = 0;
+  }
+  ~Arena() {
+    reset();
+    while(head) {
+      ArenaChunk* next = head->next;
+      free(head);
+      head = next;
+    }
+  }
+};
+
+extern thread_local Arena* current_arena; //Arena in use on this thread (or 0)
+
+//Hands object to the arena active on this thread, if any (see Arena::own)
+template<typename T>
+static inline T* arena_own(T* object) {
+  return current_arena && current_arena->active ? current_arena->own(object) : object;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#!/bin/sh
+#Runtime benchmarks
+#
+#Compiles each program in this directory at every optimization level, runs it with the interpreter and reports the size
+#of the image, the number of instructions in its code (as listed by vpp --disasm, not the number executed) and the wall
+#time of the fastest of RUNS runs. The output of every optimization level must match the output of -O0.
+#
+#Results are compared with baseline.txt; a result more than SIZE_THRESHOLD, INSTRUCTION_THRESHOLD or TIME_THRESHOLD
+#percent worse than the baseline is a regression, and makes the script fail. --update records the results as the
+#baseline instead. Times depend on the machine, so the baseline isn't part of the tree: record one before making a change.
+#
+#Usage: run.sh [--update] vpp interpreter
+
+update=0
+if [ "$1" = "--update" ]; then
+  update=1
+  shift
+fi
+VPP=$1
+UVM=$2
+if [ -z "$VPP" ] || [ -z "$UVM" ]; then
+  echo "Usage: $0 [--update] vpp interpreter"
+  exit 1
+fi
+if [ ! -x "$UVM" ]; then
+  echo "$UVM: Not an executable"
+  exit 1
+fi
+: ${SIZE_THRESHOLD:=5}
+: ${INSTRUCTION_THRESHOLD:=5}
+: ${TIME_THRESHOLD:=20}
+: ${RUNS:=3}
+LEVELS="0 1 2"
+dir=$(cd "$(dirname "$0")" && pwd)
+baseline=$dir/baseline.txt
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+#Milliseconds taken by the fastest of RUNS runs of an image (its output is left in $work/out)
+run_image() {
+  best=
+  i=0
+  while [ $i -lt $RUNS ]; do
+    start=$(date +%s%N)
+    "$UVM" "$1" > "$work/out" 2>&1
+    end=$(date +%s%N)
+    elapsed=$(( (end-start)/1000000 ))
+    if [ -z "$best" ] || [ $elapsed -lt $best ]; then
+      best=$elapsed
+    fi
+    i=$((i+1))
+  done
+  echo $best
+}
+
+#Prints a regression if value is more than threshold percent above the baseline value
+check() {
+  if [ "$3" -le 0 ]; then
+    return
+  fi
+  if [ $(( $4*100 )) -gt $(( $3*(100+$5) )) ]; then
+    echo "REGRESSION: $1 $2 went from $3 to $4 (threshold $5%)"
+    echo 1 > "$work/failed"
+  fi
+}
+
+if [ $update = 0 ] && [ ! -f "$baseline" ]; then
+  echo "No baseline to compare with; run $0 --update first"
+fi
+printf "%-10s %-5s %8s %13s %9s\n" program level size instructions "time(ms)"
+: > "$work/results"
+for source in "$dir"/*.vlang; do
+  name=$(basename "$source" .vlang)
+  for level in $LEVELS; do
+    image=$work/$name.O$level
+    if ! "$VPP" -O$level -o "$image" "$source" > "$work/log" 2>&1; then
+      echo "$name -O$level: Compilation failed"
+      cat "$work/log"
+      exit 1
+    fi
+    size=$(wc -c < "$image" | tr -d ' ')
+    instructions=$("$VPP" -O$level --disasm "$source" | sed -n 's/^[^ ].*): \([0-9]*\) instructions.*/\1/p' | awk '{total+=$1} END {print total+0}')
+    time=$(run_image "$image")
+    if [ $level = 0 ]; then
+      cp "$work/out" "$work/$name.expected"
+    elif ! cmp -s "$work/out" "$work/$name.expected"; then
+      echo "MISMATCH: $name -O$level output differs from -O0"
+      echo 1 > "$work/failed"
+    fi
+    printf "%-10s %-5s %8s %13s %9s\n" $name -O$level $size $instructions $time
+    echo "$name -O$level $size $instructions $time" >> "$work/results"
+    if [ $update = 0 ] && [ -f "$baseline" ]; then
+      set -- $(grep "^$name -O$level " "$baseline")
+      if [ $# = 5 ]; then
+	check "$name -O$level" size $3 $size $SIZE_THRESHOLD
+	check "$name -O$level" instructions $4 $instructions $INSTRUCTION_THRESHOLD
+	check "$name -O$level" time $5 $time $TIME_THRESHOLD
+      else
+	echo "$name -O$level: Not in the baseline"
+      fi
+    fi
+  done
+done
+if [ $update = 1 ]; then
+  cp "$work/results" "$baseline"
+  echo "Updated $baseline"
+fi
+if [ -f "$work/failed" ]; then
+  exit 1
+fi
@@ -0,0 +1,280 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Disassembler (--disasm)
+//
+//Prints a linked image: its import table, then the code of each unit (function, class initializer or top-level code)
+//split into basic blocks. Units and blocks are annotated with a static cost estimate: the number of instructions,
+//calls (and how many of them are to the runtime), loads and stores. Nothing is known about how often a block runs,
+//so the estimate of a unit is just the sum of its blocks.
+//
+//Instructions are decoded using encodings learned from the assembler, rather than a copy of UVM's opcode numbering.
+
+#include "vpp.h"
+#include "UVM/emit.h"
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <algorithm>
+
+#define MAX_PUSH 255 //Largest immediate value the decoder recognizes, in bytes
+
+enum Instruction {Push, Getrsp, Setrsp, Call, Store, Load, Vref, Branch, Ret, Unknown};
+static const char* mnemonics[] = {"push","getrsp","setrsp","call","store","load","vref","branch","ret","???"};
+
+//Encoding of an instruction, up to its operand (if any)
+class Encoding {
+public:
+  std::string prefix;
+  Instruction instruction;
+  size_t operand; //Size of the operand in bytes
+};
+
+class Decoded {
+public:
+  Instruction instruction = Unknown;
+  size_t size = 1;
+  const unsigned char* operand = 0;
+  size_t operandSize = 0;
+};
+
+class InstructionSet {
+public:
+  std::vector<Encoding> encodings; //Longest prefix first
+  void learn(Assembly& code, size_t start, Instruction instruction, size_t operand) {
+    Encoding encoding;
+    encoding.prefix.assign((const char*)code.bytecode+start,code.len-start-operand);
+    encoding.instruction = instruction;
+    encoding.operand = operand;
+    encodings.push_back(encoding);
+  }
+  InstructionSet() {
+    Assembly code;
+    size_t start = code.len;
+    unsigned char value[MAX_PUSH] = {0};
+    for(size_t i = 1;i<=MAX_PUSH;i++) {
+      code.push(value,i);
+      learn(code,start,Push,i);
+      start = code.len;
+    }
+    //Operands are written last (see CompilerContext::call and branch)
+    code.call(0);
+    learn(code,start,Call,sizeof(int));
+    start = code.len;
+    code.getrsp();
+    learn(code,start,Getrsp,0);
+    start = code.len;
+    code.setrsp();
+    learn(code,start,Setrsp,0);
+    start = code.len;
+    code.store();
+    learn(code,start,Store,0);
+    start = code.len;
+    code.load();
+    learn(code,start,Load,0);
+    start = code.len;
+    code.vref();
+    learn(code,start,Vref,0);
+    start = code.len;
+    code.branch();
+    learn(code,start,Branch,0);
+    start = code.len;
+    code.ret();
+    learn(code,start,Ret,0);
+    std::stable_sort(encodings.begin(),encodings.end(),[](const Encoding& a, const Encoding& b) {
+      return a.prefix.size() > b.prefix.size();
+    });
+  }
+  Decoded decode(const unsigned char* ptr, size_t len) {
+    Decoded rval;
+    for(size_t i = 0;i<encodings.size();i++) {
+      const Encoding& encoding = encodings[i];
+      if(encoding.prefix.size()+encoding.operand <= len && !memcmp(ptr,encoding.prefix.data(),encoding.prefix.size())) {
+	rval.instruction = encoding.instruction;
+	rval.operand = ptr+encoding.prefix.size();
+	rval.operandSize = encoding.operand;
+	rval.size = encoding.prefix.size()+encoding.operand;
+	break;
+      }
+    }
+    return rval;
+  }
+};
+
+//Static cost estimate of a block or unit
+class Cost {
+public:
+  size_t instructions = 0;
+  size_t calls = 0;
+  size_t externalCalls = 0;
+  size_t loads = 0;
+  size_t stores = 0;
+  void add(const Cost& other) {
+    instructions+=other.instructions;
+    calls+=other.calls;
+    externalCalls+=other.externalCalls;
+    loads+=other.loads;
+    stores+=other.stores;
+  }
+  void print(FILE* out) const {
+    fprintf(out,"%zu instructions, %zu calls (%zu external), %zu loads, %zu stores",instructions,calls,externalCalls,loads,stores);
+  }
+};
+
+static int64_t immediate(const Decoded& decoded) {
+  switch(decoded.operandSize) {
+    case 1:
+      return *(const int8_t*)decoded.operand;
+    case 2:
+    {
+      int16_t value;
+      memcpy(&value,decoded.operand,sizeof(value));
+      return value;
+    }
+    case 4:
+    {
+      int32_t value;
+      memcpy(&value,decoded.operand,sizeof(value));
+      return value;
+    }
+  }
+  int64_t value;
+  memcpy(&value,decoded.operand,sizeof(value));
+  return value;
+}
+
+//Disassembles the unit at [start,end) of image
+static void disassemble_unit(const unsigned char* image, uint64_t start, uint64_t end, const std::string& name, const LineTable& table, InstructionSet& isa, FILE* out) {
+  //First pass: find the blocks, which start at the unit's entry, at branch targets, and after branches and returns
+  std::set<uint64_t> leaders;
+  leaders.insert(start);
+  Decoded prev;
+  for(uint64_t pc = start;pc<end;) {
+    Decoded decoded = isa.decode(image+pc,end-pc);
+    if(decoded.instruction == Branch || decoded.instruction == Ret) {
+      leaders.insert(pc+decoded.size);
+      if(decoded.instruction == Branch && prev.instruction == Push && prev.operandSize == sizeof(int)) {
+	leaders.insert(immediate(prev));
+      }
+    }
+    prev = decoded;
+    pc+=decoded.size;
+  }
+  //Second pass: costs
+  prev = Decoded();
+  std::map<uint64_t,Cost> blocks;
+  Cost total;
+  uint64_t block = start;
+  for(uint64_t pc = start;pc<end;) {
+    if(leaders.find(pc) != leaders.end()) {
+      block = pc;
+    }
+    Decoded decoded = isa.decode(image+pc,end-pc);
+    Cost& cost = blocks[block];
+    cost.instructions++;
+    switch(decoded.instruction) {
+      case Call:
+      {
+	int index;
+	memcpy(&index,decoded.operand,sizeof(index));
+	cost.calls++;
+	if(index >= 0 && (size_t)index < table.imports.size() && table.imports[index].isExternal) {
+	  cost.externalCalls++;
+	}
+      }
+	break;
+      case Load:
+	cost.loads++;
+	break;
+      case Store:
+	cost.stores++;
+	break;
+    }
+    pc+=decoded.size;
+  }
+  for(auto i = blocks.begin();i != blocks.end();i++) {
+    total.add(i->second);
+  }
+  fprintf(out,"\n%s (%#llx-%#llx): ",name.data(),(unsigned long long)start,(unsigned long long)end);
+  total.print(out);
+  fprintf(out,"\n");
+  //Third pass: listing
+  prev = Decoded();
+  for(uint64_t pc = start;pc<end;) {
+    if(blocks.find(pc) != blocks.end()) {
+      fprintf(out,"L%llx: ; ",(unsigned long long)pc);
+      blocks[pc].print(out);
+      fprintf(out,"\n");
+    }
+    Decoded decoded = isa.decode(image+pc,end-pc);
+    fprintf(out,"  %6llx  %s",(unsigned long long)pc,mnemonics[decoded.instruction]);
+    switch(decoded.instruction) {
+      case Push:
+	if(decoded.operandSize <= 2 || decoded.operandSize == 4 || decoded.operandSize == 8) {
+	  fprintf(out,".%zu %lld",decoded.operandSize,(long long)immediate(decoded));
+	}else {
+	  fprintf(out,".%zu ",decoded.operandSize);
+	  for(size_t i = 0;i<decoded.operandSize;i++) {
+	    fprintf(out,"%02x",decoded.operand[i]);
+	  }
+	}
+	break;
+      case Call:
+      {
+	int index;
+	memcpy(&index,decoded.operand,sizeof(index));
+	fprintf(out," %d",index);
+	if(index >= 0 && (size_t)index < table.imports.size()) {
+	  fprintf(out," %s",table.imports[index].name.data());
+	}
+      }
+	break;
+      case Branch:
+	if(prev.instruction == Push && prev.operandSize == sizeof(int)) {
+	  fprintf(out," L%llx",(unsigned long long)immediate(prev));
+	}
+	break;
+      case Unknown:
+	fprintf(out," %02x",image[pc]);
+	break;
+    }
+    fprintf(out,"\n");
+    prev = decoded;
+    pc+=decoded.size;
+  }
+}
+
+bool disassemble(const unsigned char* image, size_t size, const LineTable& table, FILE* out) {
+  if(table.codeStart > table.codeEnd || table.codeEnd > size) {
+    return false;
+  }
+  InstructionSet isa;
+  fprintf(out,"Imports:\n");
+  for(size_t i = 0;i<table.imports.size();i++) {
+    const ImageImport& ant = table.imports[i];
+    fprintf(out,"  %3zu  %s (%d arguments, returns %d) ",i,ant.name.data(),ant.argcount,ant.outsize);
+    if(ant.isExternal) {
+      fprintf(out,"external\n");
+    }else {
+      fprintf(out,"at %#llx\n",(unsigned long long)(table.codeStart+ant.offset));
+    }
+  }
+  fprintf(out,"Code: %#llx-%#llx, data: %zu bytes\n",(unsigned long long)table.codeStart,(unsigned long long)table.codeEnd,size-table.codeEnd);
+  for(size_t i = 0;i<table.symbols.size();i++) {
+    const CodeSymbol& symbol = table.symbols[i];
+    if(symbol.start < table.codeStart || symbol.end > table.codeEnd || symbol.start > symbol.end) {
+      return false;
+    }
+    disassemble_unit(image,symbol.start,symbol.end,symbol.name,table,isa,out);
+  }
+  return true;
+}
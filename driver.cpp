@@ -0,0 +1,280 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Command line driver for the compiler library
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "vpp.h"
+#include "stats.h"
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <new>
+
+//Counts every allocation of the process for --mem-report (the library leaves the allocator to its host)
+void* operator new(size_t size) {
+  if(compiler_stats && compiler_stats->memory) {
+    compiler_stats->heapAllocations++;
+    compiler_stats->heapBytes+=size;
+  }
+  void* rval = malloc(size ? size : 1);
+  if(!rval) {
+    throw std::bad_alloc();
+  }
+  return rval;
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+int serve(const char* path, const char* prelude, const CompilerOptions& options);
+int watch(const std::vector<const char*>& filenames, const char* output, const char* prelude, const CompilerOptions& options);
+
+static bool write_file(const char* filename, const unsigned char* data, size_t len) {
+  int fd = filename ? open(filename,O_WRONLY | O_CREAT | O_TRUNC,0644) : STDOUT_FILENO;
+  if(fd<0) {
+    printf("%s: Unable to write file\n",filename);
+    return false;
+  }
+  while(len) {
+    ssize_t processed = write(fd,data,len);
+    if(processed<=0) {
+      break;
+    }
+    len-=processed;
+    data+=processed;
+  }
+  if(filename) {
+    close(fd);
+  }
+  return !len;
+}
+
+//Name of the object file for a source file (foo.vlang becomes foo.vo)
+static std::string object_name(const char* filename) {
+  std::string name = filename;
+  if(name.size()>6 && name.compare(name.size()-6,6,".vlang") == 0) {
+    name.resize(name.size()-6);
+  }
+  return name+".vo";
+}
+
+//Prints the statistics collected while compiling (to stderr, as the image may be written to stdout) when main returns
+class StatsReport {
+public:
+  enum {None, Times, Text, JSON} format = None;
+  bool memory = false; //--mem-report
+  ~StatsReport() {
+    if(!compiler_stats) {
+      return;
+    }
+    if(format == JSON) {
+      compiler_stats->printJSON(stderr);
+      return;
+    }
+    if(format != None) {
+      compiler_stats->print(stderr,format == Text);
+    }
+    if(memory) {
+      compiler_stats->printMemory(stderr);
+    }
+  }
+};
+
+int main(int argc, char** argv) {
+  StatsReport statsReport;
+  std::vector<SourceFile> files;
+  CompilerOptions options;
+  bool compileOnly = false; //Write an object file per module instead of a linked image
+  const char* output = 0;
+  const char* prelude = 0; //Precompiled prelude to load
+  const char* emitPrelude = 0; //Write the declarations of the input as a precompiled prelude
+  const char* socketPath = 0; //Serve compile requests on this socket instead of compiling files
+  bool watchFiles = false; //Recompile the files whenever they change
+  bool stream = false; //Compile one function at a time
+  const char* lineTable = 0; //Write the line table of the image to this file
+  const char* profileUse = 0; //Optimize for the execution profile in this file
+  bool disasm = false; //Print the image instead of writing it (unless -o is given)
+  for(int i = 1;i<argc;i++) {
+    if(argv[i][0] == '-' && argv[i][1] == 'O') {
+      options.optimize = argv[i][2] ? atoi(argv[i]+2) : 1;
+    }else if(strncmp(argv[i],"--unroll=",9) == 0) {
+      options.unroll = atoi(argv[i]+9);
+    }else if(argv[i][0] == '-' && argv[i][1] == 'j') {
+      options.jobs = atoi(argv[i]+2);
+    }else if(strncmp(argv[i],"--cache=",8) == 0) {
+      options.cache = argv[i]+8;
+      mkdir(options.cache,0755);
+    }else if(strncmp(argv[i],"--prelude=",10) == 0) {
+      prelude = argv[i]+10;
+    }else if(strncmp(argv[i],"--emit-prelude=",15) == 0) {
+      emitPrelude = argv[i]+15;
+    }else if(strncmp(argv[i],"--serve=",8) == 0) {
+      socketPath = argv[i]+8;
+    }else if(strncmp(argv[i],"--line-table=",13) == 0) {
+      lineTable = argv[i]+13;
+    }else if(strncmp(argv[i],"--profile-use=",14) == 0) {
+      profileUse = argv[i]+14;
+    }else if(strcmp(argv[i],"--disasm") == 0) {
+      disasm = true;
+    }else if(strcmp(argv[i],"--trace") == 0) {
+      options.trace = true;
+    }else if(strcmp(argv[i],"--instrument") == 0) {
+      options.instrument = true;
+      options.dataSection = true; //The counters live in the data section
+    }else if(strcmp(argv[i],"--stream") == 0) {
+      stream = true;
+    }else if(strcmp(argv[i],"--time-report") == 0) {
+      statsReport.format = StatsReport::Times;
+    }else if(strcmp(argv[i],"--stats") == 0) {
+      statsReport.format = StatsReport::Text;
+    }else if(strcmp(argv[i],"--stats=json") == 0) {
+      statsReport.format = StatsReport::JSON;
+    }else if(strcmp(argv[i],"--mem-report") == 0) {
+      statsReport.memory = true;
+    }else if(strcmp(argv[i],"--watch") == 0) {
+      watchFiles = true;
+    }else if(strcmp(argv[i],"-c") == 0) {
+      compileOnly = true;
+    }else if(strcmp(argv[i],"-o") == 0 && i+1<argc) {
+      output = argv[++i];
+    }else if(strcmp(argv[i],"--data-section") == 0) {
+      options.dataSection = true;
+    }else {
+      SourceFile file;
+      file.filename = argv[i];
+      files.push_back(file);
+    }
+  }
+  if(socketPath) {
+    return serve(socketPath,prelude,options);
+  }
+  if((statsReport.format != StatsReport::None || statsReport.memory) && !watchFiles) {
+    compiler_stats = new CompilerStats();
+    compiler_stats->memory = statsReport.memory;
+  }
+  const unsigned char* preludeData = 0;
+  size_t preludeSize = 0;
+  if(prelude && !(preludeData = map_prelude(prelude,&preludeSize))) {
+    return 1;
+  }
+  if(!files.size()) {
+    SourceFile file;
+    file.filename = "testprog.vlang";
+    files.push_back(file);
+  }
+  if(lineTable && (compileOnly || emitPrelude || stream || watchFiles)) {
+    printf("--line-table can't be used with -c, --emit-prelude, --stream or --watch\n");
+    return 1;
+  }
+  if(disasm && (compileOnly || emitPrelude || stream || watchFiles)) {
+    printf("--disasm can't be used with -c, --emit-prelude, --stream or --watch\n");
+    return 1;
+  }
+  if(options.instrument && (compileOnly || emitPrelude || stream || watchFiles)) {
+    printf("--instrument can't be used with -c, --emit-prelude, --stream or --watch\n");
+    return 1;
+  }
+  if(options.instrument) {
+    //Counters are kept per statement of the source, which the optimizer would move, copy and remove
+    options.optimize = 0;
+  }
+  if(profileUse && stream) {
+    printf("--profile-use can't be used with --stream\n");
+    return 1;
+  }
+  Profile profile;
+  if(profileUse) {
+    if(!read_profile(profileUse,profile)) {
+      return 1;
+    }
+    options.profile = &profile;
+  }
+  LineTable lines;
+  if(lineTable || disasm) {
+    options.lines = &lines;
+  }
+  if(watchFiles) {
+    if(!output || compileOnly || emitPrelude) {
+      printf("--watch requires -o, and can't be used with -c or --emit-prelude\n");
+      return 1;
+    }
+    std::vector<const char*> filenames;
+    for(size_t i = 0;i<files.size();i++) {
+      filenames.push_back(files[i].filename);
+    }
+    return watch(filenames,output,prelude,options);
+  }
+  if(compileOnly && output && files.size()>1) {
+    printf("-o can't be used with -c and more than one file\n");
+    return 1;
+  }
+  if(stream) {
+    if(compileOnly || emitPrelude) {
+      printf("--stream can't be used with -c or --emit-prelude\n");
+      return 1;
+    }
+    size_t sz;
+    unsigned char* code = compile_stream(files,prelude,preludeData,preludeSize,&sz,options);
+    return code && write_file(output,code,sz) ? 0 : 1;
+  }
+  
+  if(!parse_files(files,options.jobs)) {
+    return 1;
+  }
+  std::vector<Node*> instructions;
+  ScopeNode* root = compile_program(files,prelude,preludeData,preludeSize,options,instructions);
+  if(!root) {
+    return 1;
+  }
+  if(emitPrelude) {
+    return write_prelude(instructions.data(),instructions.size(),root,emitPrelude) ? 0 : 1;
+  }
+  if(compileOnly) {
+    for(size_t i = 0;i<files.size();i++) {
+      size_t sz;
+      unsigned char* code = compile_object(files[i],root,&sz,options);
+      if(!code) {
+	printf("%s: Compilation failed\n",files[i].filename);
+	return 1;
+      }
+      bool written = write_file(output ? output : object_name(files[i].filename).data(),code,sz);
+      free(code);
+      if(!written) {
+	return 1;
+      }
+    }
+    return 0;
+  }
+  size_t sz;
+  unsigned char* code = compile_image(instructions,root,&sz,options);
+  if(!code) {
+    return 1;
+  }
+  if(lineTable && !write_line_table(files,lines,lineTable)) {
+    return 1;
+  }
+  if(disasm) {
+    if(!disassemble(code,sz,lines,stdout)) {
+      printf("Unable to disassemble image\n");
+      return 1;
+    }
+    if(!output) {
+      return 0;
+    }
+  }
+  return write_file(output,code,sz) ? 0 : 1;
+}
@@ -11,12 +11,22 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 
 #include "tree.h"
+#include "vpp.h"
 #include <vector>
 #include <sstream>
 #include "UVM/emit.h"
+#include "object.h"
+#include "sha256.h"
+#include "profile.h"
 #include <string>
 #include <map>
+#include <set>
 #include <list>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <stdio.h>
+#include <unistd.h>
 
 //C++ codegen
 
@@ -30,6 +40,17 @@ public:
   LabelNode* label;
   size_t offset;
 };
+class PendingString {
+public:
+  std::string value;
+  size_t offset;
+};
+//Definitions belonging to the module being compiled into an object file
+class ModuleInfo {
+public:
+  std::set<FunctionNode*> functions;
+  std::set<VariableDeclarationNode*> variables; //Top-level variables
+};
 class CompilerContext {
 public:
   std::vector<Import> ants;
@@ -37,9 +58,33 @@ public:
   std::list<PendingFunction> pendingFunctionCalls;
   std::list<PendingLabel> pendingLabels;
   std::map<LabelNode*,size_t> labels;
-  Assembly* assembler;
+  Assembly* assembler = 0;
   ScopeNode* scope;
   FunctionNode* currentFunction = 0;
+  const CompilerOptions* options;
+  std::map<FunctionNode*,bool> addressTaken; //Functions which take the address of a local variable
+  std::string data; //Initialized data section (string literals and static variables)
+  std::map<std::string,size_t> strings; //Offsets of string literals in the data section
+  std::list<PendingString> pendingStrings;
+  bool usesData = false; //True if code refers to the data section
+  std::list<size_t> dataRelocations; //Offsets of pushed data section offsets (for object files)
+  ModuleInfo* module = 0; //Set when compiling an object file
+  std::vector<ValidationError> errors; //Reported once the units are merged, since units are generated on worker threads
+  std::vector<std::pair<size_t,uint32_t> > locations; //Offsets at which the code of statements starts, and their locations (only recorded for a line table)
+  std::vector<CodeSymbol> symbols; //Units merged into this context (only recorded for a line table)
+  const std::map<Node*,size_t>* counters = 0; //Offsets of the execution counters of if and while statements in the data section (--instrument)
+  std::string traceName; //Name of the unit, passed to the tracing runtime on entry and exit (--trace), or empty
+  //Records that the code generated next belongs to node
+  void mark(Node* node) {
+    if(!options->lines || !node->location) {
+      return;
+    }
+    if(locations.size() && locations.back().first == assembler->len) {
+      locations.back().second = node->location; //The previous statement generated no code
+    }else if(!locations.size() || locations.back().second != node->location) {
+      locations.push_back(std::make_pair((size_t)assembler->len,node->location));
+    }
+  }
   void addExtern(StringRef name, int argcount, int outsize,  bool varargs = false) {
     Import ant;
     ant.argcount = argcount;
@@ -107,6 +152,10 @@ public:
     assembler->call(0);
   }
   void ret(size_t stacksize) {
+    if(traceName.size()) {
+      stringptr(traceName);
+      call("__vpp_trace_exit");
+    }
     stacksize = -stacksize;
     assembler->getrsp();
     assembler->push(&stacksize,sizeof(stacksize));
@@ -114,6 +163,78 @@ public:
     assembler->setrsp();
     assembler->ret();
   }
+  //Reserves space in the data section, and returns its offset
+  size_t allocate(const void* value, size_t size, size_t align) {
+    if(data.size() % align) {
+      data.append(align-(data.size() % align),'\0');
+    }
+    size_t offset = data.size();
+    data.append((const char*)value,size);
+    return offset;
+  }
+  size_t string(const std::string& value) {
+    if(strings.find(value) == strings.end()) {
+      strings[value] = allocate(value.data(),value.size()+1,1);
+    }
+    return strings[value];
+  }
+  //Pushes the address of an offset into the data section
+  void dataptr(size_t offset) {
+    usesData = true;
+    assembler->push(&offset,sizeof(offset));
+    dataRelocations.push_back(assembler->len-sizeof(offset));
+    call("__uvm_intrinsic_dataptr");
+  }
+  //Adds one to a 64-bit execution counter in the data section
+  void count(size_t offset) {
+    dataptr(offset);
+    size_t size = sizeof(uint64_t);
+    assembler->push(&size,sizeof(size));
+    assembler->load();
+    uint64_t one = 1;
+    assembler->push(&one,sizeof(one));
+    assembler->call(0); //__uvm_intrinsic_ptradd
+    dataptr(offset);
+    assembler->store();
+  }
+  //Counts the execution of one side of an if or while statement (0 for the true branch or loop body, 1 for the false branch or loop exit)
+  void count(Node* node, size_t side) {
+    if(!counters) {
+      return;
+    }
+    auto counter = counters->find(node);
+    if(counter != counters->end()) {
+      count(counter->second+side*sizeof(uint64_t));
+    }
+  }
+  //Pushes the address of a string literal (which is placed in the data section when units are merged)
+  void stringptr(const std::string& value) {
+    PendingString pending;
+    pending.value = value;
+    size_t zero = 0;
+    usesData = true;
+    assembler->push(&zero,sizeof(zero));
+    pending.offset = assembler->len-sizeof(zero);
+    pendingStrings.push_back(pending);
+    call("__uvm_intrinsic_dataptr");
+  }
+  //Pushes the address of a variable
+  void address(VariableDeclarationNode* var) {
+    if(module && !var->function && module->variables.find(var) == module->variables.end()) {
+      //Top-level variables live in the frame (or data section) of their own module
+      ValidationError error;
+      error.node = var;
+      error.msg = (std::string)var->name+" is a top-level variable of another module";
+      errors.push_back(error);
+    }
+    if(var->isStatic) {
+      dataptr(var->reloffset);
+    }else {
+      assembler->getrsp(); //Offset relative to stack pointer
+      assembler->push(&var->reloffset,sizeof(var->reloffset));
+      assembler->call(0);
+    }
+  }
   void branch(LabelNode* label) {
     PendingLabel pending;
     pending.label = label;
@@ -148,6 +269,9 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
       } else {
 	//Convert bexp to function call
 	gencode_expression(bexp->function,context);
+	if(bexp->isReference) {
+	  context.assembler->vref();
+	}
       }
     }
       break;
@@ -156,6 +280,9 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
 	    UnaryNode* node = (UnaryNode*)expression;
 	    if(node->function) {
 	      gencode_expression(node->function,context);
+	      if(node->isReference) {
+		context.assembler->vref();
+	      }
 	    }else {
 	      switch(node->op) {
 		case '&':
@@ -199,9 +326,7 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
 	    {
 	      //Pass memory address of variable to function.
 	      VariableDeclarationNode* node = (VariableDeclarationNode*)duh[len-i-1];
-	      context.assembler->getrsp();
-	      context.assembler->push(&node->lambdaRef->reloffset,sizeof(void*));
-	      context.assembler->call(0);
+	      context.address(node->lambdaRef);
 	    }
 	      break;
 	  }
@@ -211,6 +336,9 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
       FunctionNode* func = call->function->function;
       
       context.call(func->mangle());
+      if(call->isReference) {
+	context.assembler->vref();
+      }
     }
       break;
     case Constant:
@@ -228,6 +356,17 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
 	  context.assembler->push(&constant->i32val,4);
 	}
 	  break;
+	case String:
+	{
+	  if(!context.options->dataSection) {
+	    ValidationError error;
+	    error.node = constant;
+	    error.msg = "String literals require --data-section";
+	    context.errors.push_back(error);
+	  }
+	  context.stringptr(constant->strval);
+	}
+	  break;
       }
       if(constant->isReference) {
 	context.assembler->vref();
@@ -238,9 +377,7 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
 	{
 	  VariableReferenceNode* varref = (VariableReferenceNode*)expression;
 	  //Compute memory address of variable
-	  context.assembler->getrsp(); //Offset relative to stack pointer
-	  context.assembler->push(&varref->variable->reloffset,sizeof(varref->variable->reloffset));
-	  context.assembler->call(0);
+	  context.address(varref->variable);
 	  
 	  //If variable is a reference, get the memory address of the reference
 	  if(varref->variable->isReference) {
@@ -263,25 +400,12 @@ void gencode_expression(Expression* expression, CompilerContext& context) {
 	  break;
   }
 }
-void gencode_function(Node** nodes, size_t count, CompilerContext& context, VariableDeclarationNode** args = 0, size_t arglen = 0);
-void gencode_function_header(FunctionNode* func, CompilerContext& context) {
-  context.currentFunction = func;
+static size_t return_size(FunctionNode* func) {
   size_t returnSize = 0;
   if(func->returnType_resolved) {
     returnSize = func->returnType_pointerLevels ? -1 : func->returnType_resolved->type->size;
   }
-  if(func->isExtern) {
-    context.addExtern(func->mangle().data(),func->args.size() ,returnSize,false); //TODO: Varargs language support
-  }else {
-    context.add(func->mangle().data(),func->args.size(),returnSize,false); //TODO: Varargs language support
-    ScopeNode* prev = context.scope;
-    context.scope = &func->scope;
-    VariableDeclarationNode** args = func->args.data();
-    size_t len = func->args.size();
-    gencode_function(func->operations.data(),func->operations.size(),context,args,len);
-    context.scope = prev;
-  }
-  context.currentFunction = 0;
+  return returnSize;
 }
 
 static void block_memusage(CompilerContext& context,Node** nodes, size_t count, size_t& memalign, size_t& stacksize) {
@@ -290,6 +414,12 @@ static void block_memusage(CompilerContext& context,Node** nodes, size_t count,
       case VariableDeclaration:
       {
 	VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	if(context.module && !node->function) {
+	  context.module->variables.insert(node);
+	}
+	if(node->isStatic) {
+	  break;
+	}
 	ClassNode* vclass = node->rclass;
 	size_t align = (node->pointerLevels+node->isReference) ? sizeof(void*) : vclass->align;
 	size_t size= (node->pointerLevels+node->isReference) ? sizeof(void*) : vclass->size;
@@ -321,7 +451,9 @@ static void block_memusage(CompilerContext& context,Node** nodes, size_t count,
       case WhileStatement:
       {
 	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
-	block_memusage(context,&node->initializer,1,memalign,stacksize);
+	if(node->initializer) {
+	  block_memusage(context,&node->initializer,1,memalign,stacksize);
+	}
 	block_memusage(context,node->body.data(),node->body.size(),memalign,stacksize);
       }
 	break;
@@ -329,13 +461,143 @@ static void block_memusage(CompilerContext& context,Node** nodes, size_t count,
   }
 }
 
+static bool takes_address(Expression* exp) {
+  switch(exp->type) {
+    case BinaryExpression:
+    {
+      BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+      if(bexp->function) {
+	return takes_address(bexp->function);
+      }
+      return takes_address(bexp->lhs) || takes_address(bexp->rhs);
+    }
+    case UnaryExpression:
+    {
+      UnaryNode* node = (UnaryNode*)exp;
+      if(node->function) {
+	return takes_address(node->function);
+      }
+      return node->op == '&' || takes_address(node->operand);
+    }
+    case FunctionCall:
+    {
+      FunctionCallNode* call = (FunctionCallNode*)exp;
+      for(size_t i = 0;i<call->args.size();i++) {
+	if(takes_address(call->args[i])) {
+	  return true;
+	}
+      }
+    }
+      break;
+  }
+  return false;
+}
+
+static bool takes_address(Node** nodes, size_t count) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case VariableDeclaration:
+      {
+	VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	if(node->assignment && takes_address(node->assignment)) {
+	  return true;
+	}
+      }
+	break;
+      case UnaryExpression:
+      case BinaryExpression:
+      case FunctionCall:
+	if(takes_address((Expression*)nodes[i])) {
+	  return true;
+	}
+	break;
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	if(takes_address(node->condition) || takes_address(node->instructions_true.data(),node->instructions_true.size()) || takes_address(node->instructions_false.data(),node->instructions_false.size())) {
+	  return true;
+	}
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	if((node->initializer && takes_address(&node->initializer,1)) || takes_address(node->condition) || takes_address(node->body.data(),node->body.size())) {
+	  return true;
+	}
+      }
+	break;
+      case ReturnStatement:
+	if(takes_address(((ReturnStatementNode*)nodes[i])->retval)) {
+	  return true;
+	}
+	break;
+    }
+  }
+  return false;
+}
+
+//Generates return f(args) as a jump which reuses (or releases) the current stack frame, instead of a nested call.
+//Returns false if the call can't be made in tail position.
+static bool gencode_tail_call(ReturnStatementNode* ret, CompilerContext& context) {
+  FunctionNode* caller = context.currentFunction;
+  if(!caller || ret->function != caller || caller->lambdaCapture || ret->retval->type != FunctionCall || ret->retval->isReference) {
+    return false;
+  }
+  if(context.traceName.size()) {
+    return false; //The caller's exit would not be traced
+  }
+  FunctionCallNode* call = (FunctionCallNode*)ret->retval;
+  FunctionNode* callee = call->function->function;
+  if(callee->isExtern || callee->lambdaCapture || return_size(callee) != return_size(caller)) {
+    return false;
+  }
+  if(context.module && context.module->functions.find(callee) == context.module->functions.end()) {
+    return false; //Entry label is in another object file
+  }
+  //Arguments must not point into the frame that is about to be reused
+  if(context.addressTaken.find(caller) == context.addressTaken.end()) {
+    context.addressTaken[caller] = takes_address(caller->operations.data(),caller->operations.size());
+  }
+  if(context.addressTaken[caller]) {
+    return false;
+  }
+  size_t argcount = call->args.size();
+  Expression** args = call->args.data();
+  for(size_t i = 0;i<argcount;i++) {
+    if(args[i]->isReference && (args[i]->type != VariableReference || !((VariableReferenceNode*)args[i])->variable->isReference)) {
+      return false;
+    }
+  }
+  for(size_t i = 0;i<argcount;i++) {
+    gencode_expression(args[argcount-i-1],context);
+  }
+  bool one = true;
+  if(callee == caller) {
+    //Arguments are stored into the existing frame by our own prologue
+    context.assembler->push(&one,1);
+    context.branch(&caller->reentry);
+  }else {
+    //Release our frame; the callee allocates its own and returns directly to our caller
+    size_t stacksize = -caller->stackSize;
+    context.assembler->getrsp();
+    context.assembler->push(&stacksize,sizeof(stacksize));
+    context.assembler->call(0);
+    context.assembler->setrsp();
+    context.assembler->push(&one,1);
+    context.branch(&callee->entry);
+  }
+  return true;
+}
+
 static void gencode_block(Node** nodes, size_t count, CompilerContext& context) {
   for(size_t i = 0;i<count;i++) {
+    context.mark(nodes[i]);
     switch(nodes[i]->type) {
       case VariableDeclaration:
       {
 	VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
-	if(node->assignment) {
+	if(node->assignment && !node->isStatic) {
 	  gencode_expression(node->assignment,context);
 	}
       }
@@ -352,14 +614,37 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
 	//Push condition to stack
 	IfStatementNode* node = (IfStatementNode*)nodes[i];
 	gencode_expression(node->condition,context);
-	//Perform branch on condition true -- at this stage, assume that branch will NOT be taken.
-	context.branch(&node->jmp_true);
 	bool one = true;
-	context.assembler->push(&one,1); //Unconditional jump to else clause after branch to true.
-	context.branch(&node->jmp_false);
-	context.add(&node->jmp_true);
-	//If clause
 	ScopeNode* prevScope = context.scope;
+	if(node->likely < 0 && node->instructions_false.size()) {
+	  //The profile says the else clause is taken more often, so it falls through
+	  context.branch(&node->jmp_true);
+	  context.count(node,1);
+	  context.scope = &node->scope_false;
+	  gencode_block(node->instructions_false.data(),node->instructions_false.size(),context);
+	  context.assembler->push(&one,1);
+	  context.branch(&node->jmp_end);
+	  context.add(&node->jmp_true);
+	  context.count(node,0);
+	  context.scope = &node->scope_true;
+	  gencode_block(node->instructions_true.data(),node->instructions_true.size(),context);
+	  context.scope = prevScope;
+	  context.add(&node->jmp_end);
+	  break;
+	}
+	if(node->likely) {
+	  //The if clause falls through: the profile says it is taken more often, or there is no else clause to fall through to instead
+	  context.assembler->call(1);
+	  context.branch(&node->jmp_false);
+	}else {
+	  //Perform branch on condition true -- at this stage, assume that branch will NOT be taken.
+	  context.branch(&node->jmp_true);
+	  context.assembler->push(&one,1); //Unconditional jump to else clause after branch to true.
+	  context.branch(&node->jmp_false);
+	  context.add(&node->jmp_true);
+	}
+	context.count(node,0);
+	//If clause
 	context.scope = &node->scope_true;
 	gencode_block(node->instructions_true.data(),node->instructions_true.size(),context);
 	//Jump past else statement
@@ -367,6 +652,7 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
 	context.branch(&node->jmp_end);
 	//Else clause (label)
 	context.add(&node->jmp_false);
+	context.count(node,1);
 	if(node->instructions_false.size()) {
 	  context.scope = &node->scope_false;
 	  gencode_block(node->instructions_false.data(),node->instructions_false.size(),context);
@@ -391,6 +677,7 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
 	context.branch(&node->end); //Exit while loop if condition is false
 	//Body of while loop
 	context.add(&node->begin);
+	context.count(node,0);
 	ScopeNode* prevScope = context.scope;
 	context.scope = &node->scope;
 	gencode_block(node->body.data(),node->body.size(),context);
@@ -400,6 +687,7 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
 	context.branch(&node->check); //Check condition again
 	//End of while loop
 	context.add(&node->end);
+	context.count(node,1);
       }
 	break;
       case Label:
@@ -417,6 +705,9 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
       case ReturnStatement:
       {
 	ReturnStatementNode* ret = (ReturnStatementNode*)nodes[i];
+	if(context.options->optimize && gencode_tail_call(ret,context)) {
+	  break;
+	}
 	gencode_expression(ret->retval,context);
 	context.ret(context.currentFunction->stackSize);
       }
@@ -426,41 +717,126 @@ static void gencode_block(Node** nodes, size_t count, CompilerContext& context)
 }
 
 
-void gencode_function(Node** nodes, size_t count, CompilerContext& context, VariableDeclarationNode** args, size_t arglen) {
-  ScopeNode* scope = context.scope;
-  Assembly* code = context.assembler;
+//A function, class initializer or the top-level code, compiled into its own buffer
+class CodeUnit {
+public:
+  Node** nodes;
+  size_t count;
+  VariableDeclarationNode** args = 0;
+  size_t arglen = 0;
+  FunctionNode* function = 0; //Function being compiled (0 for top-level code and class initializers)
+  ScopeNode* scope;
+  size_t import = -1; //Index of function in import table
+  size_t stacksize = 0;
+  Assembly code;
+  CompilerContext context;
+  std::string cacheKey; //Key of the unit's code in the compilation cache (or empty if it can't be cached)
+  bool cached = false; //True if the code was loaded from the cache
+  size_t counter = -1; //Offset of the unit's execution counter in the data section (--instrument)
+  size_t profile = -1; //Offset of the profile area, which the unit passes to the runtime when it finishes (for the top-level code of an instrumented image)
+  size_t profileSize = 0;
+  int64_t executions = -1; //Number of executions in the profile the program is optimized for (or -1 if unknown)
+  bool hot = false;
+};
+
+//Phase 0 -- Memory allocation (done serially, as lambda captures refer to the stack layout of other functions)
+static void layout_unit(CodeUnit* unit, CompilerContext& context) {
   size_t memalign = 1;
   size_t stacksize = 0;
-  //Phase 0 -- Memory allocation
-  if(args) {
-    block_memusage(context,(Node**)args,arglen,memalign,stacksize);
+  if(unit->args) {
+    block_memusage(context,(Node**)unit->args,unit->arglen,memalign,stacksize);
   }
-  block_memusage(context,nodes,count,memalign,stacksize);
-  if(context.currentFunction) {
-    if(context.currentFunction->lambdaCapture) {
+  block_memusage(context,unit->nodes,unit->count,memalign,stacksize);
+  if(unit->function) {
+    if(unit->function->lambdaCapture) {
       //Allocate memory for lambda
-      block_memusage(context,context.currentFunction->lambdaCapture->instructions.data(),context.currentFunction->lambdaCapture->instructions.size(),memalign,stacksize);
+      block_memusage(context,unit->function->lambdaCapture->instructions.data(),unit->function->lambdaCapture->instructions.size(),memalign,stacksize);
     }
+    unit->function->stackSize = stacksize;
   }
-  
-  if(context.currentFunction) {
-    context.currentFunction->stackSize = stacksize;
+  unit->stacksize = stacksize;
+}
+
+//Lists the code units of a block (the block itself, followed by the units of its classes and functions), in output order.
+//Functions are added to the import table and mangled here, so that code generation doesn't modify shared state.
+static void collect_units(Node** nodes, size_t count, FunctionNode* function, ScopeNode* scope, CompilerContext& context, std::vector<CodeUnit*>& units) {
+  CodeUnit* unit = new CodeUnit();
+  unit->nodes = nodes;
+  unit->count = count;
+  unit->function = function;
+  unit->scope = scope;
+  unit->context.module = context.module;
+  if(context.options->trace) {
+    unit->context.traceName = function ? function->mangle() : scope->mangle();
+  }
+  if(function) {
+    unit->executions = function->executions;
+    unit->hot = function->hot;
+    unit->args = function->args.data();
+    unit->arglen = function->args.size();
+    unit->import = context.ants.size();
+    context.add(function->mangle().data(),function->args.size(),return_size(function),false); //TODO: Varargs language support
+    if(context.module) {
+      context.module->functions.insert(function);
+    }
+  }
+  layout_unit(unit,context);
+  units.push_back(unit);
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)nodes[i];
+	//Generate initializer
+	if(cls->init->operations.size()) {
+	  size_t index = units.size();
+	  collect_units(cls->init->operations.data(),cls->init->operations.size(),0,&cls->scope,context,units);
+	  units[index]->executions = cls->init->executions;
+	}
+      }
+	break;
+      case Function:
+      {
+	FunctionNode* func = (FunctionNode*)nodes[i];
+	if(func->isExtern) {
+	  context.addExtern(func->mangle().data(),func->args.size(),return_size(func),false); //TODO: Varargs language support
+	}else {
+	  collect_units(func->operations.data(),func->operations.size(),func,&func->scope,context,units);
+	}
+      }
+	break;
+    }
+  }
+}
+
+static void gencode_unit(CodeUnit* unit, const CompilerOptions& options) {
+  CompilerContext& context = unit->context;
+  Assembly* code = &unit->code;
+  context.assembler = code;
+  context.scope = unit->scope;
+  context.currentFunction = unit->function;
+  context.options = &options;
+  size_t stacksize = unit->stacksize;
+  if(unit->function) {
+    context.mark(unit->function);
+    context.add(&unit->function->entry);
+  }
+  if(unit->counter != (size_t)-1) {
+    context.count(unit->counter);
+  }
+  if(context.traceName.size()) {
+    context.stringptr(context.traceName);
+    context.call("__vpp_trace_enter");
   }
   //Allocate stack
   code->getrsp();
   code->push(&stacksize,sizeof(stacksize));
   code->call(0);
   code->setrsp();
-  //Load arguments (if any)
-  if(args) {
-    for(size_t i = 0;i<arglen;i++) {
-      context.assembler->getrsp(); //Compute RSP+offset for each argument
-      context.assembler->push(&args[i]->reloffset,sizeof(void*));
-      context.assembler->call(0);
-      context.assembler->store(); //Store argument into address
-    }
+  if(unit->function) {
+    context.add(&unit->function->reentry);
   }
-  //Load lambda capture values
+  //Load lambda capture values (pushed by the caller after the arguments)
   if(context.currentFunction) {
     if(context.currentFunction->lambdaCapture) {
       ClassNode* lambduh = context.currentFunction->lambdaCapture;
@@ -481,51 +857,782 @@ void gencode_function(Node** nodes, size_t count, CompilerContext& context, Vari
       }
     }
   }
+  //Load arguments (if any)
+  if(unit->args) {
+    for(size_t i = 0;i<unit->arglen;i++) {
+      context.assembler->getrsp(); //Compute RSP+offset for each argument
+      context.assembler->push(&unit->args[i]->reloffset,sizeof(void*));
+      context.assembler->call(0);
+      context.assembler->store(); //Store argument into address
+    }
+  }
   //Generate code for current function
-  gencode_block(nodes,count,context);
+  gencode_block(unit->nodes,unit->count,context);
+  if(unit->profile != (size_t)-1) {
+    //Hand the profile to the runtime
+    context.assembler->push(&unit->profileSize,sizeof(unit->profileSize));
+    context.dataptr(unit->profile);
+    context.call("__vpp_profile_write");
+  }
   context.ret(stacksize);
-  
-  //Generate sub-nodes
+}
+
+//Generates code for all units, on one thread per core (or options.jobs threads)
+static void gencode_units(std::vector<CodeUnit*>& units, const CompilerOptions& options) {
+  size_t threads = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+  if(threads > units.size()) {
+    threads = units.size();
+  }
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for(size_t i = next++;i<units.size();i = next++) {
+      if(!units[i]->cached) {
+	gencode_unit(units[i],options);
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for(size_t i = 1;i<threads;i++) {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+  for(size_t i = 0;i<pool.size();i++) {
+    pool[i].join();
+  }
+}
+
+//Compilation cache (--cache)
+//The code of each function is stored in a file named after the SHA-256 of everything code generation reads while compiling it:
+//its (optimized) tree, the layout of its frame, and the properties of the variables and functions it refers to.
+#define CACHE_VERSION "vpp-cache-2"
+
+class CacheKey {
+public:
+  std::string data;
+  std::map<LabelNode*,uint64_t> labels; //Labels are identified by order of appearance
+  CompilerContext* context;
+  bool cacheable = true;
+  void write(uint64_t value) {
+    data.append((const char*)&value,sizeof(value));
+  }
+  void write(const std::string& value) {
+    write(value.size());
+    data+=value;
+  }
+  void label(LabelNode* label) {
+    if(labels.find(label) == labels.end()) {
+      size_t id = labels.size();
+      labels[label] = id;
+    }
+    write(labels[label]);
+  }
+  void type(TypeInfo* tinfo) {
+    if(!tinfo) {
+      write(-1);
+      return;
+    }
+    write(tinfo->type->scope.mangle());
+    write(tinfo->pointerLevels);
+    write(tinfo->type->size);
+  }
+  void variable(VariableDeclarationNode* var) {
+    if(context->module && !var->function && context->module->variables.find(var) == context->module->variables.end()) {
+      cacheable = false; //Reported as an error by code generation
+    }
+    write(var->reloffset);
+    write(var->isStatic);
+    write(var->isReference);
+    write(var->pointerLevels);
+    write(var->rclass ? var->rclass->size : 0);
+  }
+  void function(FunctionNode* func) {
+    write(func->mangle());
+    write(func->isExtern);
+    write(return_size(func));
+    write(context->module ? context->module->functions.count(func) : 1);
+    if(!func->lambdaCapture) {
+      write(-1);
+      return;
+    }
+    write(func->lambdaCapture->instructions.size());
+    for(size_t i = 0;i<func->lambdaCapture->instructions.size();i++) {
+      VariableDeclarationNode* vardec = (VariableDeclarationNode*)func->lambdaCapture->instructions[i];
+      variable(vardec);
+      variable(vardec->lambdaRef);
+    }
+  }
+  void expression(Expression* exp) {
+    write(exp->type);
+    write(exp->isReference);
+    switch(exp->type) {
+      case BinaryExpression:
+      {
+	BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+	write(bexp->op);
+	write(bexp->op2);
+	if(bexp->function) {
+	  expression(bexp->function);
+	}else {
+	  expression(bexp->lhs);
+	  expression(bexp->rhs);
+	}
+      }
+	break;
+      case UnaryExpression:
+      {
+	UnaryNode* node = (UnaryNode*)exp;
+	write(node->op);
+	write(node->op2);
+	if(node->function) {
+	  expression(node->function);
+	}else {
+	  type(node->operand->returnType); //Size of dereferenced value
+	  expression(node->operand);
+	}
+      }
+	break;
+      case FunctionCall:
+      {
+	FunctionCallNode* call = (FunctionCallNode*)exp;
+	function(call->function->function);
+	write(call->args.size());
+	for(size_t i = 0;i<call->args.size();i++) {
+	  expression(call->args[i]);
+	}
+      }
+	break;
+      case Constant:
+      {
+	ConstantNode* constant = (ConstantNode*)exp;
+	write(constant->ctype);
+	write(constant->i32val);
+	write(constant->strval);
+      }
+	break;
+      case VariableReference:
+	variable(((VariableReferenceNode*)exp)->variable);
+	break;
+    }
+  }
+  void block(Node** nodes, size_t count, ScopeNode* scope, FunctionNode* function) {
+    write(count);
+    for(size_t i = 0;i<count;i++) {
+      write(nodes[i]->type);
+      switch(nodes[i]->type) {
+	case VariableDeclaration:
+	{
+	  VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	  variable(node);
+	  write(node->assignment && !node->isStatic);
+	  if(node->assignment && !node->isStatic) {
+	    expression(node->assignment);
+	  }
+	}
+	  break;
+	case UnaryExpression:
+	case BinaryExpression:
+	case FunctionCall:
+	  expression((Expression*)nodes[i]);
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)nodes[i];
+	  expression(node->condition);
+	  block(node->instructions_true.data(),node->instructions_true.size(),&node->scope_true,function);
+	  block(node->instructions_false.data(),node->instructions_false.size(),&node->scope_false,function);
+	}
+	  break;
+	case WhileStatement:
+	{
+	  WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	  block(&node->initializer,node->initializer ? 1 : 0,scope,function);
+	  expression(node->condition);
+	  block(node->body.data(),node->body.size(),&node->scope,function);
+	}
+	  break;
+	case Label:
+	  label((LabelNode*)nodes[i]);
+	  break;
+	case Goto:
+	  label(((GotoNode*)nodes[i])->resolve(scope));
+	  break;
+	case ReturnStatement:
+	{
+	  ReturnStatementNode* ret = (ReturnStatementNode*)nodes[i];
+	  write(ret->function == function);
+	  expression(ret->retval);
+	}
+	  break;
+      }
+    }
+  }
+};
+
+//Returns the cache key of a function's code (or an empty string if it can't be cached)
+static std::string unit_key(CodeUnit* unit, CompilerContext& context, const CompilerOptions& options) {
+  CacheKey key;
+  key.context = &context;
+  key.write(CACHE_VERSION);
+  key.write(options.optimize);
+  key.write(options.dataSection);
+  key.function(unit->function);
+  key.write(unit->stacksize);
+  key.write(unit->arglen);
+  for(size_t i = 0;i<unit->arglen;i++) {
+    key.variable(unit->args[i]);
+  }
+  key.block(unit->nodes,unit->count,unit->scope,unit->function);
+  return key.cacheable ? sha256(key.data) : "";
+}
+
+static std::string cache_path(const CompilerOptions& options, const std::string& key) {
+  return std::string(options.cache)+"/"+key+".vfn";
+}
+
+//Reads a cache entry from memory or, failing that, from the cache directory
+static bool read_cache_entry(const CompilerOptions& options, const std::string& key, std::string& bytes) {
+  if(options.units) {
+    options.units->used.insert(key);
+    auto entry = options.units->entries.find(key);
+    if(entry != options.units->entries.end()) {
+      bytes = entry->second;
+      return true;
+    }
+  }
+  if(!options.cache) {
+    return false;
+  }
+  FILE* file = fopen(cache_path(options,key).data(),"rb");
+  if(!file) {
+    return false;
+  }
+  char buffer[4096];
+  size_t len;
+  while((len = fread(buffer,1,sizeof(buffer),file))) {
+    bytes.append(buffer,len);
+  }
+  fclose(file);
+  return true;
+}
+
+static void write_cache_entry(const CompilerOptions& options, const std::string& key, const std::string& bytes) {
+  if(options.units) {
+    options.units->used.insert(key);
+    options.units->entries[key] = bytes;
+  }
+  if(!options.cache) {
+    return;
+  }
+  //Write to a temporary file first, so that concurrent compilers never see a partial entry
+  std::string path = cache_path(options,key);
+  std::stringstream tmp;
+  tmp<<path<<"."<<getpid()<<"."<<std::this_thread::get_id()<<".tmp";
+  FILE* file = fopen(tmp.str().data(),"wb");
+  if(!file) {
+    return;
+  }
+  bool written = fwrite(bytes.data(),1,bytes.size(),file) == bytes.size();
+  written &= fclose(file) == 0;
+  if(!written || rename(tmp.str().data(),path.data())) {
+    remove(tmp.str().data());
+  }
+}
+
+//Loads the code of functions that are in the cache (run serially, before code generation)
+static void load_cached_units(std::vector<CodeUnit*>& units, CompilerContext& context, const CompilerOptions& options) {
+  if((!options.cache && !options.units) || options.lines || options.instrument || options.profile || options.trace) {
+    return;
+  }
+  for(size_t i = 0;i<units.size();i++) {
+    CodeUnit* unit = units[i];
+    if(!unit->function) {
+      continue; //Top-level code depends on the layout of the whole module
+    }
+    //Functions compiled ahead of the rest of the program no longer have a body to compute the key from
+    unit->cacheKey = unit->function->cacheKey.size() ? unit->function->cacheKey : unit_key(unit,context,options);
+    if(unit->cacheKey.empty()) {
+      continue;
+    }
+    std::string bytes;
+    if(!read_cache_entry(options,unit->cacheKey,bytes)) {
+      continue;
+    }
+    ObjectFile object;
+    if(!object.parse((const unsigned char*)bytes.data(),bytes.size())) {
+      continue;
+    }
+    //Offsets in the cache are relative to the start of the code, rather than the 4 byte header placeholder
+    unit->code.write(object.code.data(),object.code.size());
+    CompilerContext& ucontext = unit->context;
+    for(size_t c = 0;c<object.calls.size();c++) {
+      PendingFunction pfunc;
+      pfunc.name = object.calls[c].name;
+      pfunc.offset = object.calls[c].offset+4;
+      ucontext.pendingFunctionCalls.push_back(pfunc);
+    }
+    std::map<uint64_t,LabelNode*> targets;
+    for(size_t c = 0;c<object.branches.size();c++) {
+      LabelNode*& label = targets[object.branches[c].target];
+      if(!label) {
+	label = new LabelNode();
+	ucontext.labels[label] = object.branches[c].target+4;
+      }
+      PendingLabel plabel;
+      plabel.label = label;
+      plabel.offset = object.branches[c].offset+4;
+      ucontext.pendingLabels.push_back(plabel);
+    }
+    for(size_t c = 0;c<object.strings.size();c++) {
+      PendingString pstring;
+      pstring.value = object.strings[c].name;
+      pstring.offset = object.strings[c].offset+4;
+      ucontext.pendingStrings.push_back(pstring);
+    }
+    for(size_t c = 0;c<object.dataRelocations.size();c++) {
+      ucontext.dataRelocations.push_back(object.dataRelocations[c]+4);
+    }
+    ucontext.usesData = object.strings.size() || object.dataRelocations.size();
+    ucontext.labels[&unit->function->entry] = 4; //Target of sibling tail calls from other units
+    unit->cached = true;
+  }
+}
+
+//Adds newly generated functions to the cache
+static void store_cached_units(std::vector<CodeUnit*>& units, const CompilerOptions& options) {
+  if((!options.cache && !options.units) || options.lines || options.instrument || options.profile || options.trace) {
+    return;
+  }
+  for(size_t i = 0;i<units.size();i++) {
+    CodeUnit* unit = units[i];
+    CompilerContext& ucontext = unit->context;
+    if(unit->cached || unit->cacheKey.empty() || ucontext.errors.size()) {
+      continue;
+    }
+    ObjectFile object;
+    object.code.assign((const char*)unit->code.bytecode+4,unit->code.len-4);
+    for(auto pfunc = ucontext.pendingFunctionCalls.begin();pfunc != ucontext.pendingFunctionCalls.end();pfunc++) {
+      ObjectRelocation reloc;
+      reloc.offset = pfunc->offset-4;
+      reloc.name = pfunc->name;
+      object.calls.push_back(reloc);
+    }
+    bool local = true;
+    for(auto plabel = ucontext.pendingLabels.begin();plabel != ucontext.pendingLabels.end();plabel++) {
+      if(ucontext.labels.find(plabel->label) == ucontext.labels.end()) {
+	local = false; //Jumps into another function
+	break;
+      }
+      ObjectRelocation reloc;
+      reloc.offset = plabel->offset-4;
+      reloc.target = ucontext.labels[plabel->label]-4;
+      object.branches.push_back(reloc);
+    }
+    if(!local) {
+      continue;
+    }
+    for(auto pstring = ucontext.pendingStrings.begin();pstring != ucontext.pendingStrings.end();pstring++) {
+      ObjectRelocation reloc;
+      reloc.offset = pstring->offset-4;
+      reloc.name = pstring->value;
+      object.strings.push_back(reloc);
+    }
+    for(auto reloc = ucontext.dataRelocations.begin();reloc != ucontext.dataRelocations.end();reloc++) {
+      object.dataRelocations.push_back(*reloc-4);
+    }
+    write_cache_entry(options,unit->cacheKey,object.serialize());
+  }
+}
+
+//Counts a code buffer (for --mem-report)
+static void count_code(Assembly& code) {
+  if(compiler_stats && compiler_stats->memory) {
+    compiler_stats->codeBuffers++;
+    compiler_stats->codeBytes+=code.len;
+  }
+}
+
+//Concatenates units in order, and rebases their relocations so that context can link them.
+static void merge_units(std::vector<CodeUnit*>& units, CompilerContext& context) {
+  bool usesData = false;
+  for(size_t i = 0;i<units.size();i++) {
+    CodeUnit* unit = units[i];
+    //Units start after the 4 byte header placeholder
+    size_t rebase = context.assembler->len-4;
+    context.assembler->write(unit->code.bytecode+4,unit->code.len-4);
+    if(unit->import != (size_t)-1) {
+      context.ants[unit->import].offset = rebase;
+    }
+    for(auto pfunc = unit->context.pendingFunctionCalls.begin();pfunc != unit->context.pendingFunctionCalls.end();pfunc++) {
+      pfunc->offset+=rebase;
+      context.pendingFunctionCalls.push_back(*pfunc);
+    }
+    for(auto plabel = unit->context.pendingLabels.begin();plabel != unit->context.pendingLabels.end();plabel++) {
+      plabel->offset+=rebase;
+      context.pendingLabels.push_back(*plabel);
+    }
+    for(auto label = unit->context.labels.begin();label != unit->context.labels.end();label++) {
+      context.labels[label->first] = label->second+rebase;
+    }
+    for(auto pstring = unit->context.pendingStrings.begin();pstring != unit->context.pendingStrings.end();pstring++) {
+      size_t offset = context.string(pstring->value);
+      memcpy(context.assembler->bytecode+pstring->offset+rebase,&offset,sizeof(offset));
+      context.dataRelocations.push_back(pstring->offset+rebase);
+    }
+    for(auto reloc = unit->context.dataRelocations.begin();reloc != unit->context.dataRelocations.end();reloc++) {
+      context.dataRelocations.push_back(*reloc+rebase);
+    }
+    if(context.options->lines) {
+      for(auto location = unit->context.locations.begin();location != unit->context.locations.end();location++) {
+	context.locations.push_back(std::make_pair(location->first+rebase,location->second));
+      }
+      CodeSymbol symbol;
+      symbol.name = unit->function ? unit->function->mangle() : unit->scope->mangle();
+      symbol.start = rebase+4;
+      symbol.end = context.assembler->len;
+      context.symbols.push_back(symbol);
+    }
+    usesData |= unit->context.usesData;
+    if(compiler_stats) {
+      compiler_stats->addEmitted(unit->function ? unit->function->mangle() : unit->scope->mangle(),unit->code.len-4);
+    }
+    count_code(unit->code);
+    context.errors.insert(context.errors.end(),unit->context.errors.begin(),unit->context.errors.end());
+    delete unit;
+  }
+  if(usesData) {
+    context.addExtern("__uvm_intrinsic_dataptr",1,-1);
+  }
+}
+
+static bool has_goto(Node** nodes, size_t count) {
   for(size_t i = 0;i<count;i++) {
     switch(nodes[i]->type) {
-      case Class:
+      case Goto:
+	return true;
+      case IfStatement:
       {
-	ClassNode* cls = (ClassNode*)nodes[i];
-	//Generate initializer
-	if(cls->init->operations.size()) {
-	  ScopeNode* prevScope = context.scope;
-	  context.scope = &cls->scope;
-	  gencode_function(cls->init->operations.data(),cls->init->operations.size(),context);
-	  context.scope = prevScope;
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	if(has_goto(node->instructions_true.data(),node->instructions_true.size()) || has_goto(node->instructions_false.data(),node->instructions_false.size())) {
+	  return true;
 	}
-	
       }
 	break;
-      case Function:
+      case WhileStatement:
       {
-	FunctionNode* func = (FunctionNode*)nodes[i];
-	gencode_function_header(func,context);
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	if(has_goto(node->body.data(),node->body.size())) {
+	  return true;
+	}
       }
 	break;
     }
   }
+  return false;
 }
 
+//Moves top-level variables with constant initializers into the data section, so they don't need to be initialized at startup.
+static void layout_statics(Node** nodes, size_t count, CompilerContext& context) {
+  if(has_goto(nodes,count)) {
+    return; //A declaration could be executed more than once
+  }
+  for(size_t i = 0;i<count;i++) {
+    if(nodes[i]->type != VariableDeclaration) {
+      continue;
+    }
+    VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+    if(!node->assignment || node->isReference || node->pointerLevels || node->assignment->rhs->type != Constant) {
+      continue;
+    }
+    ConstantNode* constant = (ConstantNode*)node->assignment->rhs;
+    size_t size = node->rclass->size;
+    if(!((constant->ctype == Integer && size == 4) || (constant->ctype == Boolean && size == 1))) {
+      continue;
+    }
+    unsigned char value[4];
+    memcpy(value,&constant->i32val,4);
+    if(size == 1) {
+      value[0] = constant->i32val != 0;
+    }
+    node->reloffset = context.allocate(value,size,node->rclass->align ? node->rclass->align : 1);
+    node->isStatic = true;
+  }
+}
 
+//Lists the if and while statements of a block in pre-order, without entering nested functions and classes (which are units of their own)
+static void collect_branches(Node** nodes, size_t count, std::vector<Node*>& branches) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	branches.push_back(node);
+	collect_branches(node->instructions_true.data(),node->instructions_true.size(),branches);
+	collect_branches(node->instructions_false.data(),node->instructions_false.size(),branches);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	branches.push_back(node);
+	collect_branches(node->body.data(),node->body.size(),branches);
+      }
+	break;
+    }
+  }
+}
 
+//Lays out the profile area of an instrumented image (see profile.h) in the data section, and assigns the execution counters of units and branches
+static void layout_profile(std::vector<CodeUnit*>& units, CompilerContext& context, std::map<Node*,size_t>& counters) {
+  std::vector<uint64_t> area;
+  area.push_back(PROFILE_MAGIC);
+  area.push_back(units.size());
+  area.push_back(0);
+  std::vector<std::vector<Node*> > branches(units.size());
+  uint64_t total = 0;
+  for(size_t i = 0;i<units.size();i++) {
+    collect_branches(units[i]->nodes,units[i]->count,branches[i]);
+    std::string name = units[i]->function ? units[i]->function->mangle() : units[i]->scope->mangle();
+    area.push_back(total);
+    area.push_back(1+branches[i].size()*2);
+    area.push_back(name.size());
+    size_t words = (name.size()+7)/8;
+    area.resize(area.size()+words,0);
+    memcpy(area.data()+area.size()-words,name.data(),name.size());
+    total+=1+branches[i].size()*2;
+  }
+  area[2] = total;
+  size_t header = area.size()*sizeof(uint64_t);
+  area.resize(area.size()+total,0);
+  size_t offset = context.allocate(area.data(),area.size()*sizeof(uint64_t),sizeof(uint64_t));
+  size_t counter = offset+header;
+  for(size_t i = 0;i<units.size();i++) {
+    units[i]->counter = counter;
+    counter+=sizeof(uint64_t);
+    for(size_t c = 0;c<branches[i].size();c++) {
+      counters[branches[i][c]] = counter;
+      counter+=2*sizeof(uint64_t);
+    }
+    units[i]->context.counters = &counters;
+  }
+  units[0]->profile = offset;
+  units[0]->profileSize = area.size()*sizeof(uint64_t);
+}
+
+//Moves the code of hot functions to the start of the image (after the top-level code), most called first,
+//and code that never ran in the profile to the end. Other units keep their order.
+static void order_units(std::vector<CodeUnit*>& units) {
+  std::stable_sort(units.begin()+1,units.end(),[](CodeUnit* a, CodeUnit* b) {
+    int rankA = a->hot ? 0 : a->executions ? 1 : 2;
+    int rankB = b->hot ? 0 : b->executions ? 1 : 2;
+    if(rankA != rankB) {
+      return rankA < rankB;
+    }
+    return rankA == 0 && a->executions > b->executions;
+  });
+}
 
 //Generate code (external call)
-unsigned char* gencode(Node** nodes, size_t count, ScopeNode* scope, size_t* size) {
+//If there is a data section (CompilerOptions::dataSection), it is appended after the code, 8-byte aligned, and followed by a trailer containing
+//its size (8 bytes) and DATA_SECTION_MAGIC. The code addresses it through the __uvm_intrinsic_dataptr intrinsic, which the runtime must provide.
+unsigned char* gencode(Node** nodes, size_t count, ScopeNode* scope, size_t* size, const CompilerOptions& options) {
   CompilerContext context;
+  context.options = &options;
   Assembly code;
   context.addExtern("__uvm_intrinsic_ptradd",2,-1);
   context.addExtern("__uvm_intrinsic_not",1,1);
   context.assembler = &code;
   context.scope = scope;
-  gencode_function(nodes,count,context);
+  std::vector<CodeUnit*> units;
+  std::map<Node*,size_t> counters;
+  {
+    PhaseTimer timer("codegen");
+    if(options.optimize && options.dataSection) {
+      layout_statics(nodes,count,context);
+    }
+    collect_units(nodes,count,0,scope,context,units);
+    if(options.profile) {
+      order_units(units);
+    }
+    if(options.trace) {
+      context.addExtern("__vpp_trace_enter",1,0);
+      context.addExtern("__vpp_trace_exit",1,0);
+    }
+    if(options.instrument) {
+      context.addExtern("__vpp_profile_write",2,0);
+      layout_profile(units,context,counters);
+    }
+    load_cached_units(units,context,options);
+    gencode_units(units,options);
+    store_cached_units(units,options);
+  }
+  PhaseTimer timer("link");
+  merge_units(units,context);
+  if(context.errors.size()) {
+    for(size_t i = 0;i<context.errors.size();i++) {
+      report(context.errors[i].node,"%s",context.errors[i].msg.data());
+    }
+    return 0;
+  }
+  size_t unlinked = code.len;
   context.link();
+  if(options.lines) {
+    //Linking inserts the import table in front of the code
+    size_t shift = code.len-unlinked;
+    for(auto location = context.locations.begin();location != context.locations.end();location++) {
+      options.lines->locations.push_back(std::make_pair(location->first+shift,location->second));
+    }
+    for(auto symbol = context.symbols.begin();symbol != context.symbols.end();symbol++) {
+      symbol->start+=shift;
+      symbol->end+=shift;
+      options.lines->symbols.push_back(*symbol);
+    }
+    for(size_t i = 0;i<context.ants.size();i++) {
+      Import& ant = context.ants[i];
+      ImageImport entry;
+      entry.name.assign(ant.name,ant.namelen ? ant.namelen : strlen(ant.name));
+      entry.isExternal = ant.isExternal;
+      entry.argcount = ant.argcount;
+      entry.outsize = ant.outsize;
+      entry.offset = ant.isExternal ? 0 : ant.offset;
+      options.lines->imports.push_back(entry);
+    }
+    options.lines->codeStart = shift+4;
+    options.lines->codeEnd = code.len;
+  }
+  if(context.data.size()) {
+    if(code.len % 8) {
+      unsigned char padding[8] = {0};
+      code.write(padding,8-(code.len % 8));
+    }
+    uint64_t datalen = context.data.size();
+    code.write(context.data.data(),datalen);
+    code.write(&datalen,sizeof(datalen));
+    code.write(DATA_SECTION_MAGIC,4);
+  }
+  count_code(code);
   *size = code.len;
   void* rval = malloc(*size);
   memcpy(rval,code.bytecode,code.len);
   return (unsigned char*)rval;
 }
+
+//Generates the code of a validated (and optimized) top-level function into the in-memory cache, ahead of the rest of the program
+//(external call). Returns false if its code can't be compiled on its own: if it captures globals, which are laid out with the
+//program, contains nested functions, or jumps into another function. Otherwise the function's cacheKey is set.
+bool gencode_function(FunctionNode* function, const CompilerOptions& options) {
+  if(function->lambdaCapture || !options.units) {
+    return false;
+  }
+  PhaseTimer timer("codegen");
+  CompilerContext context;
+  Assembly scratch; //Offsets of the function in the top-level code are unused, since it is generated into its own unit
+  context.options = &options;
+  context.assembler = &scratch;
+  std::vector<CodeUnit*> units;
+  Node* node = function;
+  collect_units(&node,1,0,function->scope.parent,context,units);
+  bool rval = false;
+  if(units.size() == 2) {
+    //units[0] is the (empty) top-level code
+    delete units[0];
+    units.erase(units.begin());
+    load_cached_units(units,context,options);
+    if(!units[0]->cached) {
+      gencode_unit(units[0],options);
+      store_cached_units(units,options);
+    }
+    std::string bytes;
+    if(units[0]->cacheKey.size() && read_cache_entry(options,units[0]->cacheKey,bytes)) {
+      //Entries loaded from the cache directory are kept in memory too, so the program can't be left without them
+      options.units->entries[units[0]->cacheKey] = bytes;
+      function->cacheKey = units[0]->cacheKey;
+      rval = true;
+    }
+  }
+  for(size_t i = 0;i<units.size();i++) {
+    count_code(units[i]->code);
+    delete units[i];
+  }
+  return rval;
+}
+
+//Generate an object file containing a single module (external call)
+//The module's top-level code is exported as global\.module\<module>, which the linker calls on startup.
+unsigned char* gencode_object(Node** nodes, size_t count, ScopeNode* scope, const char* module, size_t* size, const CompilerOptions& options) {
+  CompilerContext context;
+  ModuleInfo info;
+  context.module = &info;
+  context.options = &options;
+  Assembly code;
+  context.addExtern("__uvm_intrinsic_ptradd",2,-1);
+  context.addExtern("__uvm_intrinsic_not",1,1);
+  context.assembler = &code;
+  context.scope = scope;
+  std::vector<CodeUnit*> units;
+  ObjectFile object;
+  {
+    PhaseTimer timer("codegen");
+    if(options.optimize && options.dataSection) {
+      layout_statics(nodes,count,context);
+    }
+    collect_units(nodes,count,0,scope,context,units);
+    if(options.profile) {
+      order_units(units);
+    }
+    if(options.trace) {
+      context.addExtern("__vpp_trace_enter",1,0);
+      context.addExtern("__vpp_trace_exit",1,0);
+    }
+    object.init = std::string("global\\.module\\")+module;
+    units[0]->import = context.ants.size();
+    context.add(object.init.data(),0,0);
+    load_cached_units(units,context,options);
+    gencode_units(units,options);
+    store_cached_units(units,options);
+  }
+  PhaseTimer timer("link");
+  merge_units(units,context);
+  if(context.errors.size()) {
+    for(size_t i = 0;i<context.errors.size();i++) {
+      report(context.errors[i].node,"%s",context.errors[i].msg.data());
+    }
+    return 0;
+  }
+  //Offsets in context are relative to the 4 byte header placeholder
+  for(size_t i = 0;i<context.ants.size();i++) {
+    Import& ant = context.ants[i];
+    ObjectSymbol symbol;
+    symbol.name.assign(ant.name,ant.namelen ? ant.namelen : strlen(ant.name));
+    symbol.isExternal = ant.isExternal;
+    symbol.argcount = ant.argcount;
+    symbol.outsize = ant.outsize;
+    symbol.offset = ant.isExternal ? 0 : ant.offset;
+    object.symbols.push_back(symbol);
+  }
+  count_code(code);
+  object.code.assign((const char*)code.bytecode+4,code.len-4);
+  for(auto pfunc = context.pendingFunctionCalls.begin();pfunc != context.pendingFunctionCalls.end();pfunc++) {
+    ObjectRelocation reloc;
+    reloc.offset = pfunc->offset-4;
+    reloc.name = pfunc->name;
+    object.calls.push_back(reloc);
+  }
+  for(auto plabel = context.pendingLabels.begin();plabel != context.pendingLabels.end();plabel++) {
+    if(context.labels.find(plabel->label) == context.labels.end()) {
+      return 0;
+    }
+    ObjectRelocation reloc;
+    reloc.offset = plabel->offset-4;
+    reloc.target = context.labels[plabel->label]-4;
+    object.branches.push_back(reloc);
+  }
+  object.data = context.data;
+  for(auto reloc = context.dataRelocations.begin();reloc != context.dataRelocations.end();reloc++) {
+    object.dataRelocations.push_back(*reloc-4);
+  }
+  std::string bytes = object.serialize();
+  *size = bytes.size();
+  void* rval = malloc(*size);
+  memcpy(rval,bytes.data(),bytes.size());
+  return (unsigned char*)rval;
+}
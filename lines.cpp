@@ -0,0 +1,149 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Line tables (--line-table)
+//
+//A line table maps offsets in a linked image back to the source, so that a profiler can attribute samples
+//to lines and functions. It is written as a sidecar file, made of unsigned (U) and signed (S) LEB128 numbers:
+//
+//  "VLT1"
+//  U file count, then for each file: U name length, name
+//  U symbol count, then for each symbol (in image order): U name length, mangled name,
+//    U start (relative to the end of the previous symbol), U size
+//  U row count, then for each row (in image order): U offset (relative to the previous row),
+//    S file index, S line and U column (the file and line relative to the previous row; lines and columns start at 1)
+//
+//A row covers the code up to the next row, or to the end of its symbol.
+
+#include "vpp.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+class TableWriter {
+public:
+  std::string data;
+  void write(uint64_t value) {
+    do {
+      unsigned char byte = value & 0x7f;
+      value >>= 7;
+      data.push_back(value ? byte | 0x80 : byte);
+    }while(value);
+  }
+  void writeSigned(int64_t value) {
+    while(true) {
+      unsigned char byte = value & 0x7f;
+      value >>= 7;
+      if((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40))) {
+	data.push_back(byte);
+	return;
+      }
+      data.push_back(byte | 0x80);
+    }
+  }
+  void write(const std::string& value) {
+    write(value.size());
+    data+=value;
+  }
+};
+
+//Resolves locations to files, lines and columns
+class LocationMap {
+public:
+  std::vector<SourceFile>& files;
+  std::vector<size_t> order; //Files that record locations, by base
+  std::vector<std::vector<uint32_t> > lines; //Offsets at which the lines of each file start (computed when first needed)
+  LocationMap(std::vector<SourceFile>& files):files(files),lines(files.size()) {
+    for(size_t i = 0;i<files.size();i++) {
+      if(files[i].base) {
+	order.push_back(i);
+      }
+    }
+    std::sort(order.begin(),order.end(),[&](size_t a, size_t b) {
+      return files[a].base < files[b].base;
+    });
+  }
+  bool find(uint32_t location, size_t& file, size_t& line, size_t& column) {
+    auto next = std::upper_bound(order.begin(),order.end(),location,[&](uint32_t location, size_t i) {
+      return location < files[i].base;
+    });
+    if(next == order.begin()) {
+      return false;
+    }
+    file = *(next-1);
+    std::vector<uint32_t>& starts = lines[file];
+    if(!starts.size()) {
+      starts.push_back(0);
+      for(const char* ptr = files[file].code;*ptr;ptr++) {
+	if(*ptr == '\n') {
+	  starts.push_back(ptr+1-files[file].code);
+	}
+      }
+    }
+    uint32_t offset = location-files[file].base;
+    line = std::upper_bound(starts.begin(),starts.end(),offset)-starts.begin();
+    column = offset-starts[line-1]+1;
+    return true;
+  }
+};
+
+bool write_line_table(std::vector<SourceFile>& files, const LineTable& table, const char* filename) {
+  TableWriter writer;
+  writer.data = "VLT1";
+  writer.write(files.size());
+  for(size_t i = 0;i<files.size();i++) {
+    writer.write(std::string(files[i].filename));
+  }
+  writer.write(table.symbols.size());
+  uint64_t end = 0;
+  for(size_t i = 0;i<table.symbols.size();i++) {
+    const CodeSymbol& symbol = table.symbols[i];
+    writer.write(symbol.name);
+    writer.write(symbol.start-end);
+    writer.write(symbol.end-symbol.start);
+    end = symbol.end;
+  }
+  LocationMap map(files);
+  TableWriter rows;
+  size_t count = 0;
+  uint64_t offset = 0;
+  int64_t prevFile = 0;
+  int64_t prevLine = 1;
+  for(size_t i = 0;i<table.locations.size();i++) {
+    size_t file;
+    size_t line;
+    size_t column;
+    if(!map.find(table.locations[i].second,file,line,column)) {
+      continue;
+    }
+    rows.write(table.locations[i].first-offset);
+    rows.writeSigned((int64_t)file-prevFile);
+    rows.writeSigned((int64_t)line-prevLine);
+    rows.write(column);
+    offset = table.locations[i].first;
+    prevFile = file;
+    prevLine = line;
+    count++;
+  }
+  writer.write(count);
+  writer.data+=rows.data;
+  FILE* out = fopen(filename,"wb");
+  if(!out) {
+    report(0,"%s: Unable to write file",filename);
+    return false;
+  }
+  bool written = fwrite(writer.data.data(),1,writer.data.size(),out) == writer.data.size();
+  written &= fclose(out) == 0;
+  if(!written) {
+    report(0,"%s: Unable to write file",filename);
+  }
+  return written;
+}
@@ -0,0 +1,212 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//vpp-link -- Combines object files produced by vpp -c into a single image
+
+#include <stdio.h>
+#include "object.h"
+#include "UVM/emit.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static bool read_object(const char* filename, ObjectFile& object) {
+  struct stat us;
+  int fd = open(filename,O_RDONLY);
+  if(fd<0 || fstat(fd,&us)) {
+    printf("%s: Unable to read file\n",filename);
+    return false;
+  }
+  std::vector<unsigned char> bytes(us.st_size);
+  size_t len = 0;
+  while(len<bytes.size()) {
+    ssize_t processed = read(fd,bytes.data()+len,bytes.size()-len);
+    if(processed<=0) {
+      break;
+    }
+    len+=processed;
+  }
+  close(fd);
+  if(len != bytes.size() || !object.parse(bytes.data(),bytes.size())) {
+    printf("%s: Not a VLANG object file\n",filename);
+    return false;
+  }
+  return true;
+}
+
+static void add_import(std::vector<Import>& ants, std::map<std::string,size_t>& functionTable, const ObjectSymbol& symbol, uint64_t offset) {
+  Import ant;
+  ant.argcount = symbol.argcount;
+  ant.isExternal = symbol.isExternal;
+  ant.isVarArgs = false;
+  ant.name = symbol.name.data();
+  ant.namelen = symbol.name.size();
+  ant.outsize = symbol.outsize;
+  ant.offset = offset;
+  functionTable[symbol.name] = ants.size();
+  ants.push_back(ant);
+}
+
+int main(int argc, char** argv) {
+  std::vector<const char*> filenames;
+  const char* output = 0;
+  for(int i = 1;i<argc;i++) {
+    if(strcmp(argv[i],"-o") == 0 && i+1<argc) {
+      output = argv[++i];
+    }else {
+      filenames.push_back(argv[i]);
+    }
+  }
+  if(!filenames.size()) {
+    printf("Usage: vpp-link [-o output] objects...\n");
+    return 1;
+  }
+  std::vector<ObjectFile> objects(filenames.size());
+  for(size_t i = 0;i<objects.size();i++) {
+    if(!read_object(filenames[i],objects[i])) {
+      return 1;
+    }
+  }
+  
+  //The intrinsics are called by index, so they must come first
+  std::vector<Import> ants;
+  std::map<std::string,size_t> functionTable;
+  ObjectSymbol ptradd;
+  ptradd.name = "__uvm_intrinsic_ptradd";
+  ptradd.isExternal = true;
+  ptradd.argcount = 2;
+  ptradd.outsize = -1;
+  add_import(ants,functionTable,ptradd,0);
+  ObjectSymbol unot;
+  unot.name = "__uvm_intrinsic_not";
+  unot.isExternal = true;
+  unot.argcount = 1;
+  unot.outsize = 1;
+  add_import(ants,functionTable,unot,0);
+  
+  //Layout: an entry point which calls each module's top-level code in order, followed by the code of each module.
+  //Each call is an opcode and a 4 byte import index, and the entry point ends with a 1 byte return.
+  size_t entrysize = objects.size()*5+1;
+  std::vector<size_t> codebase;
+  std::vector<size_t> database;
+  size_t codelen = entrysize;
+  size_t datalen = 0;
+  bool failed = false;
+  for(size_t i = 0;i<objects.size();i++) {
+    ObjectFile& object = objects[i];
+    codebase.push_back(codelen);
+    codelen+=object.code.size();
+    if(datalen % 8) {
+      datalen+=8-(datalen % 8);
+    }
+    database.push_back(datalen);
+    datalen+=object.data.size();
+    for(size_t c = 0;c<object.symbols.size();c++) {
+      ObjectSymbol& symbol = object.symbols[c];
+      auto existing = functionTable.find(symbol.name);
+      if(existing == functionTable.end()) {
+	add_import(ants,functionTable,symbol,codebase[i]+symbol.offset);
+      }else if(!symbol.isExternal || !ants[existing->second].isExternal) {
+	printf("%s: %s is already defined\n",filenames[i],symbol.name.data());
+	failed = true;
+      }
+    }
+  }
+  if(failed) {
+    return 1;
+  }
+  //String literals which haven't been placed yet are shared by all modules
+  std::map<std::string,size_t> strings;
+  for(size_t i = 0;i<objects.size();i++) {
+    for(size_t c = 0;c<objects[i].strings.size();c++) {
+      const std::string& value = objects[i].strings[c].name;
+      if(strings.find(value) == strings.end()) {
+	strings[value] = datalen;
+	datalen+=value.size()+1;
+      }
+    }
+  }
+  
+  Assembly code(ants.data(),ants.size());
+  size_t header = code.len;
+  for(size_t i = 0;i<objects.size();i++) {
+    code.call(functionTable[objects[i].init]);
+  }
+  code.ret();
+  for(size_t i = 0;i<objects.size();i++) {
+    code.write(objects[i].code.data(),objects[i].code.size());
+  }
+  std::string data(datalen,'\0');
+  for(size_t i = 0;i<objects.size();i++) {
+    ObjectFile& object = objects[i];
+    unsigned char* base = code.bytecode+header+codebase[i];
+    for(size_t c = 0;c<object.calls.size();c++) {
+      auto func = functionTable.find(object.calls[c].name);
+      if(func == functionTable.end()) {
+	printf("%s: Undefined reference to %s\n",filenames[i],object.calls[c].name.data());
+	failed = true;
+	continue;
+      }
+      int funcId = (int)func->second;
+      memcpy(base+object.calls[c].offset,&funcId,sizeof(funcId));
+    }
+    for(size_t c = 0;c<object.branches.size();c++) {
+      int realOffset = header+codebase[i]+object.branches[c].target;
+      memcpy(base+object.branches[c].offset,&realOffset,sizeof(realOffset));
+    }
+    for(size_t c = 0;c<object.dataRelocations.size();c++) {
+      uint64_t offset;
+      memcpy(&offset,base+object.dataRelocations[c],sizeof(offset));
+      offset+=database[i];
+      memcpy(base+object.dataRelocations[c],&offset,sizeof(offset));
+    }
+    for(size_t c = 0;c<object.strings.size();c++) {
+      uint64_t offset = strings[object.strings[c].name];
+      memcpy(base+object.strings[c].offset,&offset,sizeof(offset));
+    }
+    memcpy(&data[database[i]],object.data.data(),object.data.size());
+  }
+  for(auto str = strings.begin();str != strings.end();str++) {
+    memcpy(&data[str->second],str->first.data(),str->first.size());
+  }
+  if(failed) {
+    return 1;
+  }
+  if(data.size()) {
+    if(code.len % 8) {
+      unsigned char padding[8] = {0};
+      code.write(padding,8-(code.len % 8));
+    }
+    uint64_t size = data.size();
+    code.write(data.data(),size);
+    code.write(&size,sizeof(size));
+    code.write(DATA_SECTION_MAGIC,4);
+  }
+  int fd = output ? open(output,O_WRONLY | O_CREAT | O_TRUNC,0644) : STDOUT_FILENO;
+  if(fd<0) {
+    printf("%s: Unable to write file\n",output);
+    return 1;
+  }
+  const unsigned char* ptr = code.bytecode;
+  size_t len = code.len;
+  while(len) {
+    ssize_t processed = write(fd,ptr,len);
+    if(processed<=0) {
+      return 1;
+    }
+    len-=processed;
+    ptr+=processed;
+  }
+  return 0;
+}
@@ -11,20 +11,43 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 #include <stdio.h>
 #include "tree.h"
+#include "options.h"
+#include "vpp.h"
+#include "arena.h"
 #include <vector>
 #include <string>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sstream>
 #include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <set>
+#include <stdarg.h>
 
-unsigned char* gencode(Node** nodes, size_t count, ScopeNode* scope, size_t* sz);
+unsigned char* gencode(Node** nodes, size_t count, ScopeNode* scope, size_t* sz, const CompilerOptions& options);
+bool load_prelude(const char* filename, const unsigned char* data, size_t size, ScopeNode* root, std::vector<Node*>& instructions);
+unsigned char* gencode_object(Node** nodes, size_t count, ScopeNode* scope, const char* module, size_t* size, const CompilerOptions& options);
+void optimize(std::vector<Node*>& instructions, const CompilerOptions& options, std::vector<FunctionNode*>* evaluated = 0);
 
-class ValidationError {
-public:
-  std::string msg;
-  Node* node = 0;
-};
+thread_local std::vector<ValidationError>* diagnostics = 0;
+thread_local SourceCursor* source_cursor = 0;
+
+void report(Node* node, const char* format, ...) {
+  va_list args;
+  va_start(args,format);
+  char msg[1024];
+  vsnprintf(msg,sizeof(msg),format,args);
+  va_end(args);
+  if(!diagnostics) {
+    printf("%s\n",msg);
+    return;
+  }
+  ValidationError error;
+  error.node = node;
+  error.msg = msg;
+  diagnostics->push_back(error);
+}
 
 class Verifier {
 public:
@@ -32,6 +55,8 @@ public:
   ScopeNode* current;
   FunctionNode* currentFunction = 0;
   std::vector<ValidationError> errors;
+  std::vector<FunctionNode*>* deferred = 0; //Function bodies found during the declaration phase
+  std::vector<VariableReferenceNode*> references; //References to functions made by top-level code
   
   bool silent = false;
   void error(Node* node, const std::string& msg) {
@@ -42,7 +67,6 @@ public:
     error.node = node;
     error.msg = msg;
     errors.push_back(error);
-    printf("%s\n",msg.data());
   }
   
   Verifier(ScopeNode* scope):rootScope(scope) {
@@ -78,15 +102,11 @@ public:
 	  }
 	    break;
 	}
-	cnode->returnType = new TypeInfo();
-	cnode->returnType->type = type;
-	cnode->returnType->pointerLevels = isptr;
 	if(!type) {
-	  delete cnode->returnType;
-	  cnode->returnType = 0;
 	  error(exp,"Build environment is grinning and holding a spatula.");
 	  return false;
 	}
+	cnode->returnType = intern_type(type,isptr);
       }
       exp->validated = true;
 	return true;
@@ -167,18 +187,14 @@ public:
 		if(!call) {
 		  if(unode->op == '&' && unode->operand->type == VariableReference) {
 		    unode->function = 0;
-		    unode->returnType = new TypeInfo();
-		    unode->returnType->pointerLevels = 1;
-		    unode->returnType->type = unode->operand->returnType->type;
+		    unode->returnType = intern_type(unode->operand->returnType->type,1);
 		    unode->validated = true;
 		    return true;
 		  }
 		  if(unode->op == '*' && unode->operand->returnType->pointerLevels) {
 		    //Dereference a pointer
 		    unode->function = 0;
-		    unode->returnType = new TypeInfo();
-		    unode->returnType->pointerLevels = unode->operand->returnType->pointerLevels-1;
-		    unode->returnType->type = unode->operand->returnType->type;
+		    unode->returnType = intern_type(unode->operand->returnType->type,unode->operand->returnType->pointerLevels-1);
 		    unode->validated = true;
 		    return true;
 		  }
@@ -203,15 +219,14 @@ public:
 	      return false;
 	    }
 	    if(varref->function) {
+	      //Dependency graph edge (calls are resolved to an overload later, through the same reference)
+	      (currentFunction ? currentFunction->references : references).push_back(varref);
 	      varref->returnType = varref->function->returnType_resolved;
 	      varref->validated = true;
 	      return true;
 	    }
 	    validateNode(varref->variable);
-	    TypeInfo* tinfo = new TypeInfo();
-	    varref->returnType = tinfo;
-	    tinfo->type = varref->variable->rclass;
-	    tinfo->pointerLevels = varref->variable->pointerLevels;
+	    varref->returnType = intern_type(varref->variable->rclass,varref->variable->pointerLevels);
 	    if(currentFunction != varref->variable->function) {
 	      if(!currentFunction->lambdaCapture) {
 		currentFunction->lambdaCapture = new ClassNode();
@@ -287,11 +302,27 @@ public:
     }
     
     
-    return validateNode(init);
+    //The initializer (and the fields it declares) must be validated before any methods are.
+    return validateSignature(init) && validateBody(init);
     
   }
   
   bool validateFunction(FunctionNode* function) {
+    if(!validateSignature(function)) {
+      return false;
+    }
+    if(deferred) {
+      //Body is checked later, in parallel with the others
+      deferred->push_back(function);
+      return true;
+    }
+    return validateBody(function);
+  }
+  //Resolves return and argument types. Calls only need this much, so bodies can be validated in any order.
+  bool validateSignature(FunctionNode* function) {
+    if(function->isDeclared) {
+      return true;
+    }
     FunctionNode* prev = currentFunction;
     ScopeNode* prevScope = current;
     current = &function->scope;
@@ -301,12 +332,10 @@ public:
 	ClassNode* n = resolveClass(function,&function->scope,function->returnType);
 	if(!n) {
 	  currentFunction = prev;
+	  current = prevScope;
 	  return false;
 	}
-	TypeInfo* tinfo = new TypeInfo();
-	tinfo->pointerLevels = function->returnType_pointerLevels;
-	tinfo->type = n;
-	function->returnType_resolved = tinfo;
+	function->returnType_resolved = intern_type(n,function->returnType_pointerLevels);
 	
       }
     }
@@ -319,28 +348,17 @@ public:
 	    return false;
 	  }
 	}
-	if(!validate((Node**)function->args.data(),function->args.size())) {
-	  currentFunction = prev;
-	  current = prevScope;
-	  return false;
-	}
-	Node** funcops = function->operations.data();
-	size_t len = function->operations.size();
-	for(size_t i = 0;i<len;i++) {
-	  switch(funcops[i]->type) {
-	    case ReturnStatement:
-	    {
-	      ((ReturnStatementNode*)funcops[i])->function = function;
-	    }
-	      break;
-	    case VariableDeclaration:
-	    {
-	      ((VariableDeclarationNode*)funcops[i])->function = function;
-	      function->vars.push_back((VariableDeclarationNode*)funcops[i]);
-	    }
-	      break;
-	  }
-	}
+	currentFunction = prev;
+	current = prevScope;
+	function->isDeclared = true;
+	return true;
+  }
+  bool validateBody(FunctionNode* function) {
+    FunctionNode* prev = currentFunction;
+    ScopeNode* prevScope = current;
+    current = &function->scope;
+    currentFunction = function;
+	claimBlock(function,function->operations.data(),function->operations.size());
 	bool rval = validate(function->operations.data(),function->operations.size());
 	if(function->lambdaCapture) {
 	  rval &= validateNode(function->lambdaCapture);
@@ -350,6 +368,40 @@ public:
 	function->validated = rval;
 	return rval;
   }
+  //Mark declarations and return statements (including those nested inside if/while blocks) as belonging to function
+  void claimBlock(FunctionNode* function, Node** funcops, size_t len) {
+    for(size_t i = 0;i<len;i++) {
+      switch(funcops[i]->type) {
+	case ReturnStatement:
+	{
+	  ((ReturnStatementNode*)funcops[i])->function = function;
+	}
+	  break;
+	case VariableDeclaration:
+	{
+	  ((VariableDeclarationNode*)funcops[i])->function = function;
+	  function->vars.push_back((VariableDeclarationNode*)funcops[i]);
+	}
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)funcops[i];
+	  claimBlock(function,node->instructions_true.data(),node->instructions_true.size());
+	  claimBlock(function,node->instructions_false.data(),node->instructions_false.size());
+	}
+	  break;
+	case WhileStatement:
+	{
+	  WhileStatementNode* node = (WhileStatementNode*)funcops[i];
+	  if(node->initializer) {
+	    claimBlock(function,&node->initializer,1);
+	  }
+	  claimBlock(function,node->body.data(),node->body.size());
+	}
+	  break;
+      }
+    }
+  }
   ClassNode* resolveClass(Node* node,ScopeNode* scope, const StringRef& variable) {
     Node* n = scope->resolve(variable);
     if(!n) {
@@ -385,8 +437,14 @@ public:
   }
   FunctionNode* resolveOverload(FunctionCallNode* call) {
     FunctionNode* func = call->function->function;
+    if(compiler_stats) {
+      compiler_stats->overloadResolutions++;
+    }
     resolve:
-    if(!validateNode(func)) {
+    if(compiler_stats) {
+      compiler_stats->overloadCandidates++;
+    }
+    if(!validateSignature(func)) {
       return func;
     }
     //Argument counts must match (until we add support for default values)
@@ -426,7 +484,7 @@ public:
     Expression** args = call->args.data();
     size_t argcount = call->args.size();
     FunctionNode* function = resolveOverload(call);
-    if(!validateNode(function)) {
+    if(!validateSignature(function)) {
       return false;
     }
     call->function->function = function;
@@ -486,6 +544,9 @@ public:
     return true;
   }
   bool validateWhileStatement(WhileStatementNode* node) {
+    if(node->initializer && !validateNode(node->initializer)) {
+      return false;
+    }
     if(!validateNode(node->condition)) {
       return false;
     }
@@ -557,7 +618,7 @@ public:
 	    return false;
 	  }
 	  
-	  if(!validateExpression(n->retval)) {
+	  if(!validateNode(n->retval)) {
 	    return false;
 	  }
 	  if((n->retval->returnType->pointerLevels != n->function->returnType_pointerLevels) || (n->retval->returnType->type != n->function->returnType_resolved->type)) {
@@ -581,6 +642,51 @@ public:
     }
     return true;
   }
+  //Validates a whole program. Declarations (classes, globals, and function signatures) are checked in order on this thread,
+  //then function bodies are checked on jobs threads, each with its own Verifier.
+  bool validateProgram(Node** instructions, size_t count, int jobs) {
+    std::vector<FunctionNode*> bodies;
+    deferred = &bodies;
+    bool rval = validate(instructions,count);
+    deferred = 0;
+    if(rval && bodies.size()) {
+      std::vector<Verifier*> workers;
+      for(size_t i = 0;i<bodies.size();i++) {
+	workers.push_back(new Verifier(rootScope));
+      }
+      size_t threads = jobs ? jobs : std::thread::hardware_concurrency();
+      if(threads > bodies.size()) {
+	threads = bodies.size();
+      }
+      std::atomic<size_t> next(0);
+      std::atomic<bool> failed(false);
+      auto worker = [&]() {
+	for(size_t i = next++;i<bodies.size();i = next++) {
+	  if(!workers[i]->validateBody(bodies[i])) {
+	    failed = true;
+	  }
+	}
+      };
+      std::vector<std::thread> pool;
+      for(size_t i = 1;i<threads;i++) {
+	pool.push_back(std::thread(worker));
+      }
+      worker();
+      for(size_t i = 0;i<pool.size();i++) {
+	pool[i].join();
+      }
+      rval = !failed;
+      //Report errors in source order regardless of which thread found them
+      for(size_t i = 0;i<workers.size();i++) {
+	errors.insert(errors.end(),workers[i]->errors.begin(),workers[i]->errors.end());
+	delete workers[i];
+      }
+    }
+    for(size_t i = 0;i<errors.size();i++) {
+      report(errors[i].node,"%s",errors[i].msg.data());
+    }
+    return rval;
+  }
 };
 
 
@@ -754,11 +860,12 @@ public:
 	      retval = tine;
 	    }
 	  }
-	}
+	}else {
 	VariableReferenceNode* varref = new VariableReferenceNode();
 	varref->id = id;
 	varref->scope = scope;
 	retval = varref;
+	}
       }else {
 	if(*ptr == '(') {
 	  ptr++;
@@ -803,6 +910,47 @@ public:
 	      retval = unode;
 	    }
 	      break;
+	    case '"':
+	    {
+	      //String literal
+	      ptr++;
+	      ConstantNode* node = new ConstantNode();
+	      node->ctype = String;
+	      node->value.ptr = ptr;
+	      while(*ptr != '"') {
+		if(!*ptr) {
+		  delete node;
+		  return 0;
+		}
+		if(*ptr == '\\') {
+		  ptr++;
+		  switch(*ptr) {
+		    case 'n':
+		      node->strval+='\n';
+		      break;
+		    case 't':
+		      node->strval+='\t';
+		      break;
+		    case '0':
+		      node->strval+='\0';
+		      break;
+		    case 0:
+		      delete node;
+		      return 0;
+		    default:
+		      node->strval+=*ptr;
+		      break;
+		  }
+		}else {
+		  node->strval+=*ptr;
+		}
+		ptr++;
+	      }
+	      node->value.count = ptr-node->value.ptr;
+	      ptr++;
+	      retval = node;
+	    }
+	      break;
 	  }
 	}
       }
@@ -1022,7 +1170,7 @@ public:
 	while(*ptr != ')' && *ptr) {
 	  VariableDeclarationNode* vardec = new VariableDeclarationNode();
 	  vardec->function = retval;
-	  if(!expectToken(vardec->vartype)) {
+	  if(!parseTypeName(vardec->vartype,vardec->pointerLevels)) {
 	    goto v_fail;
 	  }
 	  skipWhitespace();
@@ -1064,22 +1212,14 @@ public:
 	{
 	  return 0;
 	}
-	ptr++;
-	skipWhitespace();
-	while(*ptr != '}') {
-	  if(!(*ptr)) {
+	if(skipBodies && parentScope == &scope) {
+	  retval->source = ptr;
+	  if(!skipBlock()) {
 	    goto l_free;
 	  }
-	  Node* node = parse(&retval->scope);
-	  if(node) {
-	    retval->operations.push_back(node);
-	  }else {
-	    if(*ptr != '}') {
-	      goto l_free;
-	    }
-	  }
+	}else if(!parseBlock(retval)) {
+	  goto l_free;
 	}
-	ptr++;
 	if(!scope.add(retval->name,retval)) {
 	    FunctionNode* onode = (FunctionNode*)scope.resolve(retval->name);
 	    //Add overload
@@ -1097,6 +1237,64 @@ public:
     
   }
   
+  //Parses the body of a function, starting at its opening brace
+  bool parseBlock(FunctionNode* function) {
+    ptr++;
+    skipWhitespace();
+    while(*ptr != '}') {
+      if(!(*ptr)) {
+	return false;
+      }
+      Node* node = parse(&function->scope);
+      if(node) {
+	function->operations.push_back(node);
+      }else {
+	if(*ptr != '}') {
+	  return false;
+	}
+      }
+    }
+    ptr++;
+    return true;
+  }
+  //Skips over a block without parsing it
+  bool skipBlock() {
+    size_t depth = 0;
+    while(true) {
+      skipWhitespace();
+      switch(*ptr) {
+	case 0:
+	  return false;
+	case '{':
+	  depth++;
+	  break;
+	case '}':
+	  if(!--depth) {
+	    ptr++;
+	    return true;
+	  }
+	  break;
+	case '"':
+	  for(ptr++;*ptr != '"';ptr++) {
+	    if(!*ptr || (*ptr == '\\' && !*++ptr)) {
+	      return false;
+	    }
+	  }
+	  break;
+      }
+      ptr++;
+    }
+  }
+  //Parses the body of a top-level function that was skipped
+  bool parseBody(FunctionNode* function) {
+    ptr = function->source;
+    function->source = 0;
+    SourceCursor* outer = track();
+    bool rval = parseBlock(function);
+    source_cursor = outer;
+    return rval;
+  }
+  
   bool parseTypeName(StringRef& type, int& ptrlevels) {
     
     if(!expectToken(type)) {
@@ -1468,7 +1666,19 @@ public:
   std::vector<Node*> instructions;
   ScopeNode scope;
   bool error = false;
-  VParser(const char* code):ParseTree(code) {
+  bool skipBodies; //Leave the bodies of top-level functions in the source (see parseBody)
+  SourceCursor cursor; //Position of this parser (recorded by the nodes it creates if cursor.base is nonzero)
+  //Makes the nodes constructed on this thread record their position in this parser's file. Returns the cursor to restore afterwards.
+  SourceCursor* track() {
+    SourceCursor* outer = source_cursor;
+    source_cursor = cursor.base ? &cursor : 0;
+    return outer;
+  }
+  VParser(const char* code, bool skipBodies = false, uint32_t base = 0):ParseTree(code),skipBodies(skipBodies) {
+   cursor.ptr = &ptr;
+   cursor.code = code;
+   cursor.base = base;
+   SourceCursor* outer = track();
    while(*ptr) {
     Node* instruction = parse(&scope);
     skipWhitespace();
@@ -1479,42 +1689,349 @@ public:
       break;
     }
    }
+   source_cursor = outer;
   }
 };
 
-int main(int argc, char** argv) {
+static bool read_file(SourceFile& file) {
   struct stat us;
-  int fd = 0;
-  const char* filename = "testprog.vlang";
-  if(argc == 1) {
-    fd = open(filename,O_RDONLY);
-  }else {
-    filename = argv[1];
-    fd = open(argv[1],O_RDONLY);
+  int fd = open(file.filename,O_RDONLY);
+  if(fd<0 || fstat(fd,&us)) {
+    return false;
   }
-  fstat(fd,&us);
-  char* mander = new char[us.st_size];
-  char* ptr = mander;
+  file.code = new char[us.st_size+1];
+  char* ptr = file.code;
   while(us.st_size) {
-    size_t processed = read(fd,ptr,us.st_size);
+    ssize_t processed = read(fd,ptr,us.st_size);
+    if(processed<=0) {
+      break;
+    }
     us.st_size-=processed;
     ptr+=processed;
   }
+  *ptr = 0;
   close(fd);
-  
-  const char* test = "";
-  VParser tounge(mander);
-  tounge.scope.name = "global";
-  if(!tounge.error) {
-    Verifier place(&tounge.scope);
-    if(place.validate(tounge.instructions.data(),tounge.instructions.size())) {
-    size_t sz;
-    unsigned char* code = gencode(tounge.instructions.data(),tounge.instructions.size(),&tounge.scope,&sz);
-    write(STDOUT_FILENO,code,sz);
-    }else {
-      printf("Compilation failed due to validation errors.\n");
+  return true;
+}
+
+bool parse_source(SourceFile& file) {
+  file.parser = arena_own(new VParser(file.code,file.skipBodies,file.base));
+  file.instructions = &file.parser->instructions;
+  file.scope = &file.parser->scope;
+  return !file.parser->error;
+}
+
+//Calls stage(i) for every i below count, on up to threads threads
+template<typename F>
+static void run_parallel(size_t count, size_t threads, F stage) {
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for(size_t i = next++;i<count;i = next++) {
+      stage(i);
+    }
+  };
+  std::vector<std::thread> pool;
+  for(size_t i = 1;i<threads;i++) {
+    pool.push_back(std::thread(worker));
+  }
+  worker();
+  for(size_t i = 0;i<pool.size();i++) {
+    pool[i].join();
+  }
+}
+
+//Reads and parses each file on its own thread. Parsers share no state, so no locking is needed.
+//Every file is read before any is parsed, so that each phase can be timed on its own.
+bool parse_files(std::vector<SourceFile>& files, int jobs) {
+  size_t threads = jobs ? jobs : std::thread::hardware_concurrency();
+  if(threads > files.size()) {
+    threads = files.size();
+  }
+  std::vector<char> readable(files.size());
+  {
+    PhaseTimer timer("read");
+    run_parallel(files.size(),threads,[&](size_t i) {
+      readable[i] = read_file(files[i]);
+    });
+  }
+  //Number the bytes of all files in one range of locations (files past 4GB don't record locations)
+  uint64_t base = 1;
+  for(size_t i = 0;i<files.size();i++) {
+    if(readable[i]) {
+      size_t size = strlen(files[i].code)+1;
+      if(base+size <= UINT32_MAX) {
+	files[i].base = base;
+	base+=size;
+      }
+    }
+  }
+  {
+    PhaseTimer timer("parse");
+    run_parallel(files.size(),threads,[&](size_t i) {
+      if(readable[i]) {
+	parse_source(files[i]);
+      }
+    });
+  }
+  bool rval = true;
+  for(size_t i = 0;i<files.size();i++) {
+    if(!files[i].parser) {
+      report(0,"%s: Unable to read file",files[i].filename);
+      rval = false;
+    }else if(files[i].parser->error) {
+      report(0,"%s: Unexpected end of file",files[i].filename);
+      rval = false;
     }
-  }else {
-    printf("Unexpected end of file\n");
   }
+  return rval;
 }
+
+static bool same_signature(FunctionNode* a, FunctionNode* b) {
+  if(a->args.size() != b->args.size() || (std::string)a->returnType != (std::string)b->returnType || a->returnType_pointerLevels != b->returnType_pointerLevels) {
+    return false;
+  }
+  for(size_t i = 0;i<a->args.size();i++) {
+    if((std::string)a->args[i]->vartype != (std::string)b->args[i]->vartype || a->args[i]->pointerLevels != b->args[i]->pointerLevels) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//Moves the global declarations of every file into root (which may already hold the declarations of a prelude),
+//and appends each file's instructions (in command line order) to instructions. Functions with the same name become
+//overloads; identical extern declarations are merged. Any other duplicate name is an error.
+static bool merge_files(ScopeNode* root, const char* prelude, std::vector<SourceFile>& files, std::vector<Node*>& instructions) {
+  std::map<StringRef,const char*> origin; //File that first declared each global
+  for(auto token = root->tokens.begin();token != root->tokens.end();token++) {
+    origin[token->first] = prelude;
+  }
+  bool rval = true;
+  for(size_t i = 0;i<files.size();i++) {
+    ScopeNode* scope = &files[i].parser->scope;
+    std::set<Node*> merged; //Extern declarations that already exist in root
+    for(auto token = scope->tokens.begin();token != scope->tokens.end();token++) {
+      if(root->add(token->first,token->second)) {
+	origin[token->first] = files[i].filename;
+	continue;
+      }
+      Node* existing = root->tokens.find(token->first)->second;
+      if(existing->type != Function || token->second->type != Function) {
+	report(0,"%s: %s conflicts with a declaration in %s",files[i].filename,((std::string)token->first).data(),origin[token->first]);
+	rval = false;
+	continue;
+      }
+      FunctionNode* onode = (FunctionNode*)existing;
+      FunctionNode* func = (FunctionNode*)token->second;
+      while(func) {
+	FunctionNode* nextFunc = func->nextOverload;
+	FunctionNode* match = onode;
+	while(match && !same_signature(match,func)) {
+	  match = match->nextOverload;
+	}
+	if(!match) {
+	  //Add overload
+	  func->nextOverload = onode->nextOverload;
+	  onode->nextOverload = func;
+	}else if(match->isExtern && func->isExtern) {
+	  merged.insert(func);
+	}else {
+	  report(0,"%s: %s is already defined in %s",files[i].filename,((std::string)token->first).data(),origin[token->first]);
+	  rval = false;
+	}
+	func = nextFunc;
+      }
+    }
+    scope->tokens.clear();
+    //Nested scopes still point at this file's scope; resolve through (and mangle as) the root.
+    scope->parent = root;
+    scope->mangled_name = root->mangle();
+    std::vector<Node*>& nodes = files[i].parser->instructions;
+    std::vector<Node*> kept;
+    for(size_t c = 0;c<nodes.size();c++) {
+      if(merged.find(nodes[c]) == merged.end()) {
+	kept.push_back(nodes[c]);
+      }
+    }
+    nodes.swap(kept);
+    instructions.insert(instructions.end(),nodes.begin(),nodes.end());
+  }
+  return rval;
+}
+
+//Merges and validates parsed files into root, which already holds the declarations of the prelude (if any)
+static ScopeNode* validate_program(ScopeNode* root, const char* prelude, const std::vector<Node*>& declarations, std::vector<SourceFile>& files, const CompilerOptions& options, std::vector<Node*>& instructions, std::vector<VariableReferenceNode*>* references) {
+  //The prelude is declared as if it were at the start of the first file
+  std::vector<Node*>& nodes = files[0].parser->instructions;
+  nodes.insert(nodes.begin(),declarations.begin(),declarations.end());
+  if(!merge_files(root,prelude,files,instructions)) {
+    report(0,"Compilation failed due to conflicting declarations.");
+    return 0;
+  }
+  Verifier place(root);
+  if(!place.validateProgram(instructions.data(),instructions.size(),options.jobs)) {
+    report(0,"Compilation failed due to validation errors.");
+    return 0;
+  }
+  if(references) {
+    references->swap(place.references);
+  }
+  return root;
+}
+
+ScopeNode* compile_program(std::vector<SourceFile>& files, const char* prelude, const unsigned char* preludeData, size_t preludeSize, const CompilerOptions& options, std::vector<Node*>& instructions, std::vector<VariableReferenceNode*>* references) {
+  PhaseTimer timer("validate");
+  ScopeNode* root = new ScopeNode();
+  root->name = "global";
+  std::vector<Node*> declarations;
+  if(prelude && !load_prelude(prelude,preludeData,preludeSize,root,declarations)) {
+    return 0;
+  }
+  return validate_program(root,prelude,declarations,files,options,instructions,references);
+}
+
+bool parse_body(SourceFile& file, FunctionNode* function) {
+  PhaseTimer timer("parse");
+  if(!file.parser->parseBody(function)) {
+    report(function,"%s: Unable to parse the body of %s",file.filename,((std::string)function->name).data());
+    return false;
+  }
+  return true;
+}
+
+bool validate_function(FunctionNode* function, ScopeNode* root) {
+  PhaseTimer timer("validate");
+  Verifier place(root);
+  bool rval = place.validateFunction(function);
+  for(size_t i = 0;i<place.errors.size();i++) {
+    report(place.errors[i].node,"%s",place.errors[i].msg.data());
+  }
+  return rval;
+}
+
+unsigned char* compile_image(std::vector<Node*>& instructions, ScopeNode* root, size_t* size, const CompilerOptions& options) {
+  if(options.profile) {
+    apply_profile(instructions,root,*options.profile);
+  }
+  optimize(instructions,options);
+  return gencode(instructions.data(),instructions.size(),root,size,options);
+}
+
+unsigned char* compile_object(SourceFile& file, ScopeNode* root, size_t* size, const CompilerOptions& options) {
+  //Every file is validated against the declarations of the others, but only contains its own code
+  std::vector<Node*>& nodes = file.parser->instructions;
+  if(options.profile) {
+    apply_profile(nodes,root,*options.profile);
+  }
+  optimize(nodes,options);
+  return gencode_object(nodes.data(),nodes.size(),root,file.filename,size,options);
+}
+
+Compiler::Compiler() {
+  arena = new Arena();
+  preludeArena = new Arena();
+}
+
+Compiler::~Compiler() {
+  delete arena;
+  delete preludeArena;
+}
+
+bool Compiler::loadPrelude(const char* filename) {
+  errors.clear();
+  prelude = 0;
+  preludeScope = 0;
+  preludeDeclarations.clear();
+  preludeOverloads.clear();
+  preludeArena->reset(); //Releases the previous prelude
+  Arena* outerArena = current_arena;
+  std::vector<ValidationError>* outerErrors = diagnostics;
+  current_arena = preludeArena;
+  preludeArena->active = true;
+  std::vector<ValidationError> found;
+  diagnostics = &found;
+  size_t size;
+  const unsigned char* data = map_prelude(filename,&size);
+  if(data) {
+    preludeScope = new ScopeNode();
+    preludeScope->name = "global";
+    //Loaded declarations are already validated, so programs only need to declare them
+    if(load_prelude(filename,data,size,preludeScope,preludeDeclarations)) {
+      prelude = filename;
+      for(auto token = preludeScope->tokens.begin();token != preludeScope->tokens.end();token++) {
+	if(token->second->type == Function) {
+	  for(FunctionNode* func = (FunctionNode*)token->second;func;func = func->nextOverload) {
+	    preludeOverloads.push_back(std::make_pair(func,func->nextOverload));
+	  }
+	}
+      }
+    }
+  }
+  preludeArena->active = false;
+  diagnostics = outerErrors;
+  current_arena = outerArena;
+  errors.swap(found);
+  return prelude;
+}
+
+//Compiles a NUL-terminated source buffer to a linked image (allocated with malloc), or returns 0 if the program is invalid
+static unsigned char* compile_buffer(const char* filename, char* code, ScopeNode* root, const char* prelude, const std::vector<Node*>& declarations, size_t* size, const CompilerOptions& options) {
+  std::vector<SourceFile> files(1);
+  files[0].filename = filename;
+  files[0].code = code;
+  files[0].base = 1;
+  if(!parse_source(files[0])) {
+    report(0,"%s: Unexpected end of file",filename);
+    return 0;
+  }
+  std::vector<Node*> instructions;
+  {
+    PhaseTimer timer("validate");
+    if(!validate_program(root,prelude,declarations,files,options,instructions,0)) {
+      return 0;
+    }
+  }
+  return compile_image(instructions,root,size,options);
+}
+
+bool Compiler::compile(const char* filename, const char* source, size_t size, std::vector<unsigned char>& image) {
+  errors.clear();
+  image.clear();
+  arena->reset(); //Releases the previous program
+  Arena* outerArena = current_arena;
+  std::vector<ValidationError>* outerErrors = diagnostics;
+  current_arena = arena;
+  arena->active = true;
+  std::vector<ValidationError> found;
+  diagnostics = &found;
+  //Names in the tree refer to the source, so it is kept with the rest of the program
+  char* code = (char*)arena->allocate(size+1);
+  memcpy(code,source,size);
+  code[size] = 0;
+  CompilerOptions programOptions = options;
+  programOptions.jobs = 1; //Memory allocated from the arena can't be released on other threads
+  ScopeNode* root = new ScopeNode();
+  root->name = "global";
+  if(prelude) {
+    for(auto token = preludeScope->tokens.begin();token != preludeScope->tokens.end();token++) {
+      root->add(token->first,token->second);
+    }
+  }
+  size_t len;
+  unsigned char* rval = compile_buffer(filename,code,root,prelude,preludeDeclarations,&len,programOptions);
+  //The program added its overloads to the prelude's functions, and is released by the next compilation
+  for(size_t i = 0;i<preludeOverloads.size();i++) {
+    preludeOverloads[i].first->nextOverload = preludeOverloads[i].second;
+  }
+  arena->active = false;
+  diagnostics = outerErrors;
+  current_arena = outerArena;
+  errors.swap(found);
+  if(!rval) {
+    return false;
+  }
+  image.assign(rval,rval+len);
+  free(rval);
+  return true;
+}
+
@@ -0,0 +1,183 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef OBJECT_HEADER
+#define OBJECT_HEADER
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+//VLANG object files hold the code of one module before linking.
+//All offsets are relative to the start of the module's code (or data). Integers are stored as 64 bit values.
+#define OBJECT_MAGIC "VOBJ"
+#define OBJECT_VERSION 2
+//Trailer of the data section appended to linked images (preceded by the 8 byte size of the section)
+#define DATA_SECTION_MAGIC "VDAT"
+
+class ObjectSymbol {
+public:
+  std::string name; //Mangled name
+  bool isExternal; //Imported from the runtime (otherwise defined in this module)
+  int argcount;
+  int outsize;
+  uint64_t offset; //Start of function (if defined in this module)
+};
+
+class ObjectRelocation {
+public:
+  uint64_t offset; //Location of the value to patch
+  std::string name; //Function whose import table index is stored (function calls)
+  uint64_t target; //Code offset whose absolute address is stored (branches)
+};
+
+class ObjectFile {
+public:
+  std::string init; //Symbol of the module's top-level code
+  std::vector<ObjectSymbol> symbols;
+  std::string code;
+  std::vector<ObjectRelocation> calls; //4 byte import table indices
+  std::vector<ObjectRelocation> branches; //4 byte absolute code addresses
+  std::string data; //Initialized data section
+  std::vector<uint64_t> dataRelocations; //8 byte data section offsets
+  std::vector<ObjectRelocation> strings; //8 byte data section offsets of string literals that haven't been placed yet (name holds the string)
+  
+  void write(std::string& out, const void* value, size_t size) const {
+    out.append((const char*)value,size);
+  }
+  void write(std::string& out, uint64_t value) const {
+    write(out,&value,sizeof(value));
+  }
+  void write(std::string& out, const std::string& value) const {
+    write(out,value.size());
+    out+=value;
+  }
+  std::string serialize() const {
+    std::string out = OBJECT_MAGIC;
+    write(out,OBJECT_VERSION);
+    write(out,init);
+    write(out,symbols.size());
+    for(size_t i = 0;i<symbols.size();i++) {
+      write(out,symbols[i].name);
+      write(out,symbols[i].isExternal);
+      write(out,symbols[i].argcount);
+      write(out,symbols[i].outsize);
+      write(out,symbols[i].offset);
+    }
+    write(out,code);
+    write(out,calls.size());
+    for(size_t i = 0;i<calls.size();i++) {
+      write(out,calls[i].offset);
+      write(out,calls[i].name);
+    }
+    write(out,branches.size());
+    for(size_t i = 0;i<branches.size();i++) {
+      write(out,branches[i].offset);
+      write(out,branches[i].target);
+    }
+    write(out,data);
+    write(out,dataRelocations.size());
+    for(size_t i = 0;i<dataRelocations.size();i++) {
+      write(out,dataRelocations[i]);
+    }
+    write(out,strings.size());
+    for(size_t i = 0;i<strings.size();i++) {
+      write(out,strings[i].offset);
+      write(out,strings[i].name);
+    }
+    return out;
+  }
+  
+  //Reads an object file. Returns false if it is truncated or is not an object file.
+  bool parse(const unsigned char* ptr, size_t len) {
+    const unsigned char* end = ptr+len;
+    auto read = [&](void* value, size_t size) {
+      if((size_t)(end-ptr)<size) {
+	return false;
+      }
+      memcpy(value,ptr,size);
+      ptr+=size;
+      return true;
+    };
+    auto readint = [&](uint64_t& value) {
+      return read(&value,sizeof(value));
+    };
+    auto readstr = [&](std::string& value) {
+      uint64_t size;
+      if(!readint(size) || (uint64_t)(end-ptr)<size) {
+	return false;
+      }
+      value.assign((const char*)ptr,size);
+      ptr+=size;
+      return true;
+    };
+    char magic[4];
+    uint64_t version;
+    uint64_t count;
+    if(!read(magic,4) || memcmp(magic,OBJECT_MAGIC,4) || !readint(version) || version != OBJECT_VERSION || !readstr(init)) {
+      return false;
+    }
+    if(!readint(count)) {
+      return false;
+    }
+    symbols.resize(count);
+    for(size_t i = 0;i<count;i++) {
+      uint64_t isExternal;
+      uint64_t argcount;
+      uint64_t outsize;
+      if(!readstr(symbols[i].name) || !readint(isExternal) || !readint(argcount) || !readint(outsize) || !readint(symbols[i].offset)) {
+	return false;
+      }
+      symbols[i].isExternal = isExternal;
+      symbols[i].argcount = (int)argcount;
+      symbols[i].outsize = (int)outsize;
+    }
+    if(!readstr(code) || !readint(count)) {
+      return false;
+    }
+    calls.resize(count);
+    for(size_t i = 0;i<count;i++) {
+      if(!readint(calls[i].offset) || !readstr(calls[i].name)) {
+	return false;
+      }
+    }
+    if(!readint(count)) {
+      return false;
+    }
+    branches.resize(count);
+    for(size_t i = 0;i<count;i++) {
+      if(!readint(branches[i].offset) || !readint(branches[i].target)) {
+	return false;
+      }
+    }
+    if(!readstr(data) || !readint(count)) {
+      return false;
+    }
+    dataRelocations.resize(count);
+    for(size_t i = 0;i<count;i++) {
+      if(!readint(dataRelocations[i])) {
+	return false;
+      }
+    }
+    if(!readint(count)) {
+      return false;
+    }
+    strings.resize(count);
+    for(size_t i = 0;i<count;i++) {
+      if(!readint(strings[i].offset) || !readstr(strings[i].name)) {
+	return false;
+      }
+    }
+    return ptr == end;
+  }
+};
+
+#endif
@@ -0,0 +1,1496 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "tree.h"
+#include "options.h"
+#include <vector>
+#include <set>
+#include <map>
+#include <list>
+#include <algorithm>
+
+//AST optimizer (runs on the validated tree, before codegen)
+
+
+//Returns true if type is the global class of the given name, which the validator gives to literals (int or bool)
+static bool is_builtin(ClassNode* type, const char* name) {
+  if(!type) {
+    return false;
+  }
+  ScopeNode* root = &type->scope;
+  while(root->parent) {
+    root = root->parent;
+  }
+  return root->resolve(name) == type;
+}
+
+//Extern operator methods of int map to UVM host arithmetic, and are treated as free of side effects.
+//Operators of other classes are calls into the runtime like any other extern, whatever the size of the class.
+static bool is_pure(FunctionNode* func) {
+  if(!func || !func->isExtern || !func->thisType || !func->name.count) {
+    return false;
+  }
+  const char* result;
+  switch(func->name.ptr[0]) {
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+      result = "int";
+      break;
+    case '<':
+    case '>':
+      result = "bool";
+      break;
+    default:
+      return false;
+  }
+  if(func->name.count == 2 && func->name.ptr[1] != '=') {
+    return false; //Increment/decrement
+  }
+  if(func->name.count == 2 && (func->name.ptr[0] == '+' || func->name.ptr[0] == '-')) {
+    return false; //Compound assignment
+  }
+  TypeInfo* rtype = func->returnType_resolved;
+  if(func->args.size() != 2 || func->args[0]->pointerLevels || !rtype || rtype->pointerLevels) {
+    return false;
+  }
+  return is_builtin(func->thisType,"int") && func->args[0]->rclass == func->thisType && is_builtin(rtype->type,result);
+}
+//Pure operators which can't trap, and so may be evaluated even if the original program wouldn't have.
+static bool is_speculatable(FunctionNode* func) {
+  return is_pure(func) && func->name.ptr[0] != '/';
+}
+
+static FunctionCallNode* expression_call(Expression* exp) {
+  switch(exp->type) {
+    case BinaryExpression:
+      return ((BinaryExpressionNode*)exp)->function;
+    case UnaryExpression:
+      return ((UnaryNode*)exp)->function;
+    case FunctionCall:
+      return (FunctionCallNode*)exp;
+  }
+  return 0;
+}
+
+//Operator calls keep their operands in two places (lhs/rhs and call arguments); keep them in sync after rewriting arguments.
+static void sync_operands(Expression* exp) {
+  switch(exp->type) {
+    case BinaryExpression:
+    {
+      BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+      if(bexp->function) {
+	bexp->rhs = bexp->function->args[0];
+	bexp->lhs = bexp->function->args[1];
+      }
+    }
+      break;
+    case UnaryExpression:
+    {
+      UnaryNode* unode = (UnaryNode*)exp;
+      if(unode->function) {
+	unode->operand = unode->function->args[0];
+      }
+    }
+      break;
+  }
+}
+
+static ConstantNode* make_constant(int value, TypeInfo* type) {
+  ConstantNode* constant = new ConstantNode();
+  constant->ctype = Integer;
+  constant->i32val = value;
+  constant->returnType = type;
+  constant->validated = true;
+  return constant;
+}
+
+static VariableReferenceNode* make_reference(VariableDeclarationNode* var) {
+  VariableReferenceNode* varref = new VariableReferenceNode();
+  varref->id = var->name;
+  varref->scope = 0;
+  varref->variable = var;
+  varref->returnType = intern_type(var->rclass,var->pointerLevels);
+  varref->validated = true;
+  return varref;
+}
+
+static BinaryExpressionNode* make_assignment(VariableDeclarationNode* var, Expression* value) {
+  BinaryExpressionNode* bexp = new BinaryExpressionNode();
+  bexp->op = '=';
+  bexp->lhs = make_reference(var);
+  bexp->lhs->isReference = true;
+  bexp->rhs = value;
+  bexp->parenthesized = false;
+  bexp->function = 0;
+  bexp->returnType = value->returnType;
+  bexp->validated = true;
+  return bexp;
+}
+
+//Builds a call to a pure operator on the type of lhs, or returns 0 if the class doesn't define one.
+static BinaryExpressionNode* make_operator(const char* op, Expression* lhs, Expression* rhs) {
+  ClassNode* type = lhs->returnType->type;
+  Node* m = type->scope.resolve(op);
+  if(!m || m->type != Function) {
+    return 0;
+  }
+  FunctionNode* f = (FunctionNode*)m;
+  while(f && !(f->thisType == type && f->args.size() == 2 && f->args[0]->rclass == rhs->returnType->type && !f->args[0]->pointerLevels)) {
+    f = f->nextOverload;
+  }
+  if(!is_pure(f) || !f->returnType_resolved) {
+    return 0;
+  }
+  lhs->isReference = true;
+  FunctionCallNode* call = new FunctionCallNode();
+  call->args.push_back(rhs);
+  call->args.push_back(lhs);
+  VariableReferenceNode* varref = new VariableReferenceNode();
+  varref->function = f;
+  varref->id = f->name;
+  varref->scope = &type->scope;
+  varref->returnType = f->returnType_resolved;
+  varref->validated = true;
+  call->function = varref;
+  call->returnType = f->returnType_resolved;
+  call->validated = true;
+  BinaryExpressionNode* bexp = new BinaryExpressionNode();
+  bexp->op = op[0];
+  bexp->op2 = op[1];
+  bexp->lhs = lhs;
+  bexp->rhs = rhs;
+  bexp->parenthesized = false;
+  bexp->function = call;
+  bexp->returnType = call->returnType;
+  bexp->validated = true;
+  return bexp;
+}
+
+static VariableDeclarationNode* make_temporary(Expression* value, FunctionNode* function) {
+  VariableDeclarationNode* vardec = new VariableDeclarationNode();
+  vardec->rclass = value->returnType->type;
+  vardec->pointerLevels = value->returnType->pointerLevels;
+  vardec->function = function;
+  vardec->skipValidateClassName = true;
+  vardec->assignment = make_assignment(vardec,value);
+  vardec->validated = true;
+  return vardec;
+}
+
+
+
+//Variables whose address is taken anywhere in a function (and may therefore be written through a pointer)
+static void find_escaped(Expression* exp, std::set<VariableDeclarationNode*>& escaped);
+static void find_escaped(Node** nodes, size_t count, std::set<VariableDeclarationNode*>& escaped) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case VariableDeclaration:
+      {
+	VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	if(node->assignment) {
+	  find_escaped(node->assignment,escaped);
+	}
+      }
+	break;
+      case UnaryExpression:
+      case BinaryExpression:
+      case FunctionCall:
+	find_escaped((Expression*)nodes[i],escaped);
+	break;
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	find_escaped(node->condition,escaped);
+	find_escaped(node->instructions_true.data(),node->instructions_true.size(),escaped);
+	find_escaped(node->instructions_false.data(),node->instructions_false.size(),escaped);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	if(node->initializer) {
+	  find_escaped(&node->initializer,1,escaped);
+	}
+	find_escaped(node->condition,escaped);
+	find_escaped(node->body.data(),node->body.size(),escaped);
+      }
+	break;
+      case ReturnStatement:
+	find_escaped(((ReturnStatementNode*)nodes[i])->retval,escaped);
+	break;
+    }
+  }
+}
+static void find_escaped(Expression* exp, std::set<VariableDeclarationNode*>& escaped) {
+  FunctionCallNode* call = expression_call(exp);
+  if(call) {
+    for(size_t i = 0;i<call->args.size();i++) {
+      find_escaped(call->args[i],escaped);
+    }
+    return;
+  }
+  switch(exp->type) {
+    case BinaryExpression:
+    {
+      BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+      find_escaped(bexp->lhs,escaped);
+      find_escaped(bexp->rhs,escaped);
+    }
+      break;
+    case UnaryExpression:
+    {
+      UnaryNode* unode = (UnaryNode*)exp;
+      if(unode->op == '&' && unode->operand->type == VariableReference) {
+	escaped.insert(((VariableReferenceNode*)unode->operand)->variable);
+      }
+      find_escaped(unode->operand,escaped);
+    }
+      break;
+  }
+}
+
+
+
+class LoopInfo {
+public:
+  std::set<VariableDeclarationNode*>* escaped;
+  std::map<VariableDeclarationNode*,size_t> writes; //Number of writes to each variable inside the loop
+  std::set<VariableDeclarationNode*> declared; //Variables declared inside the loop body
+  bool impureCall = false; //Loop calls a function which may write to memory
+  bool pointerStore = false; //Loop stores through a pointer
+  bool unstructured = false; //Loop contains labels, gotos or declarations which can't be moved
+  void write(VariableDeclarationNode* var) {
+    writes[var]++;
+  }
+  bool invariant(Expression* exp) {
+    switch(exp->type) {
+      case Constant:
+	return ((ConstantNode*)exp)->ctype == Integer || ((ConstantNode*)exp)->ctype == Boolean;
+      case VariableReference:
+      {
+	VariableDeclarationNode* var = ((VariableReferenceNode*)exp)->variable;
+	if(!var || declared.count(var) || writes.count(var)) {
+	  return false;
+	}
+	if(var->isReference && impureCall) {
+	  return false; //Captured variable may be written by another lambda
+	}
+	if(escaped->count(var) && (impureCall || pointerStore)) {
+	  return false;
+	}
+	return true;
+      }
+    }
+    FunctionCallNode* call = expression_call(exp);
+    if(!call || !is_speculatable(call->function->function) || !call->returnType) {
+      return false;
+    }
+    for(size_t i = 0;i<call->args.size();i++) {
+      if(!invariant(call->args[i])) {
+	return false;
+      }
+    }
+    return true;
+  }
+  void analyze(Expression* exp) {
+    FunctionCallNode* call = expression_call(exp);
+    if(call) {
+      FunctionNode* func = call->function->function;
+      bool pure = is_pure(func);
+      for(size_t i = 0;i<call->args.size();i++) {
+	analyze(call->args[i]);
+	if(!pure && call->args[i]->isReference && call->args[i]->type == VariableReference) {
+	  write(((VariableReferenceNode*)call->args[i])->variable);
+	}
+      }
+      if(!pure) {
+	impureCall = true;
+	if(func->lambdaCapture) {
+	  Node** duh = func->lambdaCapture->instructions.data();
+	  size_t len = func->lambdaCapture->instructions.size();
+	  for(size_t i = 0;i<len;i++) {
+	    if(duh[i]->type == VariableDeclaration) {
+	      write(((VariableDeclarationNode*)duh[i])->lambdaRef);
+	    }
+	  }
+	}
+      }
+      return;
+    }
+    switch(exp->type) {
+      case BinaryExpression:
+      {
+	BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+	if(bexp->op == '=') {
+	  if(bexp->lhs->type == VariableReference) {
+	    write(((VariableReferenceNode*)bexp->lhs)->variable);
+	  }else {
+	    pointerStore = true;
+	  }
+	}
+	analyze(bexp->lhs);
+	analyze(bexp->rhs);
+      }
+	break;
+      case UnaryExpression:
+	analyze(((UnaryNode*)exp)->operand);
+	break;
+    }
+  }
+  void analyze(Node** nodes, size_t count) {
+    for(size_t i = 0;i<count;i++) {
+      switch(nodes[i]->type) {
+	case VariableDeclaration:
+	{
+	  VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	  declared.insert(node);
+	  if(node->assignment) {
+	    analyze(node->assignment);
+	  }
+	}
+	  break;
+	case UnaryExpression:
+	case BinaryExpression:
+	case FunctionCall:
+	  analyze((Expression*)nodes[i]);
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)nodes[i];
+	  analyze(node->condition);
+	  analyze(node->instructions_true.data(),node->instructions_true.size());
+	  analyze(node->instructions_false.data(),node->instructions_false.size());
+	}
+	  break;
+	case WhileStatement:
+	{
+	  WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	  if(node->initializer) {
+	    analyze(&node->initializer,1);
+	  }
+	  analyze(node->condition);
+	  analyze(node->body.data(),node->body.size());
+	}
+	  break;
+	case ReturnStatement:
+	  analyze(((ReturnStatementNode*)nodes[i])->retval);
+	  break;
+	case Label:
+	case Goto:
+	case Function:
+	case Class:
+	  unstructured = true;
+	  break;
+      }
+    }
+  }
+};
+
+//Recognizes v = v + c, v = v - c and v++/v-- (where ++ and -- are implemented as *this = *this + c on the class).
+static VariableDeclarationNode* induction_step(Node* node, int& step) {
+  BinaryExpressionNode* assign = 0;
+  VariableDeclarationNode* var = 0;
+  VariableDeclarationNode* self = 0; //Variable which must appear on the right-hand side
+  switch(node->type) {
+    case BinaryExpression:
+    {
+      assign = (BinaryExpressionNode*)node;
+      if(assign->function || assign->op != '=' || assign->lhs->type != VariableReference) {
+	return 0;
+      }
+      var = self = ((VariableReferenceNode*)assign->lhs)->variable;
+    }
+      break;
+    case UnaryExpression:
+    {
+      UnaryNode* unode = (UnaryNode*)node;
+      if(!unode->function || unode->operand->type != VariableReference) {
+	return 0;
+      }
+      FunctionNode* func = unode->function->function->function;
+      if(func->isExtern || func->lambdaCapture || func->operations.size() != 1 || func->args.size() != 1 || func->operations[0]->type != BinaryExpression) {
+	return 0;
+      }
+      var = ((VariableReferenceNode*)unode->operand)->variable;
+      self = func->args[0];
+      assign = (BinaryExpressionNode*)func->operations[0];
+      //*this = ...
+      if(assign->function || assign->op != '=' || assign->lhs->type != UnaryExpression) {
+	return 0;
+      }
+      UnaryNode* deref = (UnaryNode*)assign->lhs;
+      if(deref->function || deref->op != '*' || deref->operand->type != VariableReference || ((VariableReferenceNode*)deref->operand)->variable != self) {
+	return 0;
+      }
+    }
+      break;
+    default:
+      return 0;
+  }
+  if(assign->rhs->type != BinaryExpression) {
+    return 0;
+  }
+  BinaryExpressionNode* arith = (BinaryExpressionNode*)assign->rhs;
+  if(!arith->function || !is_pure(arith->function->function->function) || arith->op2 || (arith->op != '+' && arith->op != '-')) {
+    return 0;
+  }
+  if(arith->rhs->type != Constant || ((ConstantNode*)arith->rhs)->ctype != Integer) {
+    return 0;
+  }
+  Expression* operand = arith->lhs;
+  if(operand->type == UnaryExpression && node->type == UnaryExpression) {
+    UnaryNode* deref = (UnaryNode*)operand;
+    if(deref->function || deref->op != '*') {
+      return 0;
+    }
+    operand = deref->operand;
+  }
+  if(operand->type != VariableReference || ((VariableReferenceNode*)operand)->variable != self) {
+    return 0;
+  }
+  step = ((ConstantNode*)arith->rhs)->i32val;
+  if(arith->op == '-') {
+    step = -step;
+  }
+  return var;
+}
+
+
+class InductionVariable {
+public:
+  size_t index; //Index of the update statement in the loop body
+  int step;
+};
+
+//Basic induction variables of a loop (updated exactly once per iteration by a top-level statement)
+static void find_induction(WhileStatementNode* loop, LoopInfo& info, std::map<VariableDeclarationNode*,InductionVariable>& induction) {
+  for(size_t i = 0;i<loop->body.size();i++) {
+    int step;
+    VariableDeclarationNode* var = induction_step(loop->body[i],step);
+    if(var && info.writes.find(var)->second == 1 && !info.declared.count(var) && !info.escaped->count(var) && !var->isReference && !var->pointerLevels) {
+      InductionVariable iv;
+      iv.index = i;
+      iv.step = step;
+      induction[var] = iv;
+    }
+  }
+}
+
+
+//Walks every expression in a block, allowing each one to be replaced.
+class ExpressionRewriter {
+public:
+  //Called before visiting sub-expressions; returns true if the expression was replaced (and should not be visited further)
+  virtual bool replace(Expression*&) {
+    return false;
+  }
+  //Called after visiting sub-expressions
+  virtual void post(Expression*&) {
+  }
+  void rewrite(Expression*& slot) {
+    if(replace(slot)) {
+      return;
+    }
+    FunctionCallNode* call = expression_call(slot);
+    if(call) {
+      for(size_t i = 0;i<call->args.size();i++) {
+	rewrite(call->args[i]);
+      }
+      sync_operands(slot);
+    }else {
+      switch(slot->type) {
+	case BinaryExpression:
+	{
+	  BinaryExpressionNode* bexp = (BinaryExpressionNode*)slot;
+	  //Assignment target is not a value
+	  if(bexp->lhs->type != VariableReference) {
+	    rewrite(bexp->lhs);
+	  }
+	  rewrite(bexp->rhs);
+	}
+	  break;
+	case UnaryExpression:
+	{
+	  UnaryNode* unode = (UnaryNode*)slot;
+	  if(unode->op != '&') {
+	    rewrite(unode->operand);
+	  }
+	}
+	  break;
+      }
+    }
+    post(slot);
+  }
+  void rewrite(Node** nodes, size_t count) {
+    for(size_t i = 0;i<count;i++) {
+      switch(nodes[i]->type) {
+	case VariableDeclaration:
+	{
+	  VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	  if(node->assignment) {
+	    rewrite(node->assignment->rhs);
+	  }
+	}
+	  break;
+	case UnaryExpression:
+	case BinaryExpression:
+	case FunctionCall:
+	{
+	  //Statements are evaluated for their side effects, so only their operands are rewritten.
+	  Expression* exp = (Expression*)nodes[i];
+	  FunctionCallNode* call = expression_call(exp);
+	  if(call) {
+	    for(size_t c = 0;c<call->args.size();c++) {
+	      rewrite(call->args[c]);
+	    }
+	    sync_operands(exp);
+	  }else {
+	    rewrite(exp);
+	  }
+	}
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)nodes[i];
+	  rewrite(node->condition);
+	  rewrite(node->instructions_true.data(),node->instructions_true.size());
+	  rewrite(node->instructions_false.data(),node->instructions_false.size());
+	}
+	  break;
+	case WhileStatement:
+	{
+	  WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	  if(node->initializer) {
+	    rewrite(&node->initializer,1);
+	  }
+	  rewrite(node->condition);
+	  rewrite(node->body.data(),node->body.size());
+	}
+	  break;
+	case ReturnStatement:
+	  rewrite(((ReturnStatementNode*)nodes[i])->retval);
+	  break;
+      }
+    }
+  }
+};
+
+
+//Integer literals are typed as the prelude's int class, whose extern operators are UVM's 32-bit integer arithmetic.
+static bool evaluate_operator(FunctionNode* func, int self, int other, int& result) {
+  std::string op = func->name;
+  if(op == "+") {
+    result = (int)((unsigned int)self+(unsigned int)other);
+  }else if(op == "-") {
+    result = (int)((unsigned int)self-(unsigned int)other);
+  }else if(op == "*") {
+    result = (int)((unsigned int)self*(unsigned int)other);
+  }else if(op == "/") {
+    if(!other || (self == (-2147483647-1) && other == -1)) {
+      return false;
+    }
+    result = self/other;
+  }else if(op == "<") {
+    result = self<other;
+  }else if(op == ">") {
+    result = self>other;
+  }else if(op == "<=") {
+    result = self<=other;
+  }else if(op == ">=") {
+    result = self>=other;
+  }else {
+    return false;
+  }
+  return true;
+}
+
+//Replaces slot with a constant of the given type, if it is int or bool
+static bool replace_constant(Expression*& slot, int value, TypeInfo* type) {
+  if(!type || type->pointerLevels) {
+    return false;
+  }
+  bool boolean = is_builtin(type->type,"bool");
+  if(!boolean && !is_builtin(type->type,"int")) {
+    return false;
+  }
+  ConstantNode* constant = make_constant(value,type);
+  if(boolean) {
+    constant->ctype = Boolean;
+  }
+  constant->isReference = slot->isReference;
+  slot = constant;
+  return true;
+}
+
+//Folds pure operators applied to integer constants
+class ConstantFolder:public ExpressionRewriter {
+public:
+  void post(Expression*& slot) {
+    FunctionCallNode* call = expression_call(slot);
+    if(!call || call->args.size() != 2 || !is_pure(call->function->function)) {
+      return;
+    }
+    Expression* self = call->args[1];
+    Expression* other = call->args[0];
+    if(self->type != Constant || other->type != Constant || ((ConstantNode*)self)->ctype != Integer || ((ConstantNode*)other)->ctype != Integer) {
+      return;
+    }
+    int result;
+    if(!evaluate_operator(call->function->function,((ConstantNode*)self)->i32val,((ConstantNode*)other)->i32val,result)) {
+      return;
+    }
+    replace_constant(slot,result,call->returnType);
+  }
+};
+
+
+#define EVALUATION_STEPS 100000 //Maximum number of statements executed while evaluating a call at compile time
+#define EVALUATION_DEPTH 64 //Maximum call depth while evaluating a call at compile time
+
+//Stack frame of a function being evaluated at compile time
+class EvaluationFrame {
+public:
+  std::map<VariableDeclarationNode*,int> values;
+  std::map<VariableDeclarationNode*,int*> pointers; //Pointer variables (such as this) and what they point to
+  bool returned = false;
+  int retval = 0;
+};
+
+//Interprets calls at compile time. Only int and bool values (and pointers to them passed as arguments) are supported;
+//anything else, including calls to externs other than pure operators, aborts evaluation.
+class Evaluator {
+public:
+  std::set<FunctionNode*>* evaluated = 0; //Functions whose bodies have been interpreted
+  size_t steps = 0;
+  size_t depth = 0;
+  std::list<int> temporaries; //Storage for values whose address is taken
+  bool scalar(ClassNode* type, int pointerLevels) {
+    return !pointerLevels && (is_builtin(type,"int") || is_builtin(type,"bool"));
+  }
+  int* pointer(Expression* exp, EvaluationFrame& frame) {
+    if(exp->isReference) {
+      return address(exp,frame);
+    }
+    if(exp->type == VariableReference) {
+      std::map<VariableDeclarationNode*,int*>::iterator ptr = frame.pointers.find(((VariableReferenceNode*)exp)->variable);
+      if(ptr != frame.pointers.end()) {
+	return ptr->second;
+      }
+    }
+    return 0;
+  }
+  int* address(Expression* exp, EvaluationFrame& frame) {
+    switch(exp->type) {
+      case VariableReference:
+      {
+	VariableDeclarationNode* var = ((VariableReferenceNode*)exp)->variable;
+	if(!var || var->isReference || !scalar(var->rclass,var->pointerLevels)) {
+	  return 0;
+	}
+	return &frame.values[var];
+      }
+      case UnaryExpression:
+      {
+	UnaryNode* node = (UnaryNode*)exp;
+	if(!node->function) {
+	  return node->op == '*' ? pointer(node->operand,frame) : 0;
+	}
+      }
+	break;
+    }
+    int value;
+    if(!evaluate(exp,frame,value)) {
+      return 0;
+    }
+    temporaries.push_back(value);
+    return &temporaries.back();
+  }
+  bool evaluate(Expression* exp, EvaluationFrame& frame, int& result) {
+    switch(exp->type) {
+      case Constant:
+      {
+	ConstantNode* constant = (ConstantNode*)exp;
+	if(constant->ctype != Integer && constant->ctype != Boolean) {
+	  return false;
+	}
+	result = constant->i32val;
+	return true;
+      }
+      case VariableReference:
+      {
+	int* value = address(exp,frame);
+	if(!value) {
+	  return false;
+	}
+	result = *value;
+	return true;
+      }
+      case BinaryExpression:
+      {
+	BinaryExpressionNode* bexp = (BinaryExpressionNode*)exp;
+	if(bexp->function) {
+	  return call(bexp->function,frame,result);
+	}
+	if(bexp->op != '=' || bexp->op2) {
+	  return false;
+	}
+	if(!evaluate(bexp->rhs,frame,result)) {
+	  return false;
+	}
+	int* dest = address(bexp->lhs,frame);
+	if(!dest) {
+	  return false;
+	}
+	*dest = result;
+	return true;
+      }
+      case UnaryExpression:
+      {
+	UnaryNode* node = (UnaryNode*)exp;
+	if(node->function) {
+	  return call(node->function,frame,result);
+	}
+	if(node->op != '*') {
+	  return false;
+	}
+	int* value = pointer(node->operand,frame);
+	if(!value) {
+	  return false;
+	}
+	result = *value;
+	return true;
+      }
+      case FunctionCall:
+	return call((FunctionCallNode*)exp,frame,result);
+    }
+    return false;
+  }
+  bool call(FunctionCallNode* call, EvaluationFrame& frame, int& result) {
+    FunctionNode* func = call->function->function;
+    if(!func || call->args.size() != func->args.size()) {
+      return false;
+    }
+    if(func->isExtern) {
+      int self;
+      int other;
+      if(!is_pure(func) || call->args.size() != 2 || !evaluate(call->args[1],frame,self) || !evaluate(call->args[0],frame,other)) {
+	return false;
+      }
+      return evaluate_operator(func,self,other,result);
+    }
+    if(evaluated) {
+      evaluated->insert(func);
+    }
+    //Bodies which aren't in the tree (see compile_stream) can't be evaluated
+    if(func->lambdaCapture || func->source || func->cacheKey.size() || depth >= EVALUATION_DEPTH) {
+      return false;
+    }
+    if(func->returnType_resolved && !scalar(func->returnType_resolved->type,func->returnType_resolved->pointerLevels)) {
+      return false;
+    }
+    EvaluationFrame callee;
+    for(size_t i = 0;i<call->args.size();i++) {
+      VariableDeclarationNode* arg = func->args[i];
+      if(arg->isReference) {
+	return false;
+      }
+      if(arg->pointerLevels == 1 && scalar(arg->rclass,0)) {
+	int* ptr = pointer(call->args[i],frame);
+	if(!ptr) {
+	  return false;
+	}
+	callee.pointers[arg] = ptr;
+      }else {
+	if(!scalar(arg->rclass,arg->pointerLevels) || !evaluate(call->args[i],frame,callee.values[arg])) {
+	  return false;
+	}
+      }
+    }
+    depth++;
+    bool success = execute(func->operations.data(),func->operations.size(),callee);
+    depth--;
+    if(!success || (func->returnType_resolved && !callee.returned)) {
+      return false;
+    }
+    result = callee.retval;
+    return true;
+  }
+  bool execute(Node** nodes, size_t count, EvaluationFrame& frame) {
+    for(size_t i = 0;i<count && !frame.returned;i++) {
+      if(++steps > EVALUATION_STEPS) {
+	return false;
+      }
+      int value;
+      switch(nodes[i]->type) {
+	case VariableDeclaration:
+	{
+	  VariableDeclarationNode* node = (VariableDeclarationNode*)nodes[i];
+	  if(node->isReference || !scalar(node->rclass,node->pointerLevels)) {
+	    return false;
+	  }
+	  frame.values[node] = 0;
+	  if(node->assignment && !evaluate(node->assignment,frame,value)) {
+	    return false;
+	  }
+	}
+	  break;
+	case UnaryExpression:
+	case BinaryExpression:
+	case FunctionCall:
+	  if(!evaluate((Expression*)nodes[i],frame,value)) {
+	    return false;
+	  }
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)nodes[i];
+	  if(!evaluate(node->condition,frame,value)) {
+	    return false;
+	  }
+	  std::vector<Node*>& block = value ? node->instructions_true : node->instructions_false;
+	  if(!execute(block.data(),block.size(),frame)) {
+	    return false;
+	  }
+	}
+	  break;
+	case WhileStatement:
+	{
+	  WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	  if(node->initializer && !execute(&node->initializer,1,frame)) {
+	    return false;
+	  }
+	  while(!frame.returned) {
+	    if(++steps > EVALUATION_STEPS || !evaluate(node->condition,frame,value)) {
+	      return false;
+	    }
+	    if(!value) {
+	      break;
+	    }
+	    if(!execute(node->body.data(),node->body.size(),frame)) {
+	      return false;
+	    }
+	  }
+	}
+	  break;
+	case ReturnStatement:
+	  if(!evaluate(((ReturnStatementNode*)nodes[i])->retval,frame,frame.retval)) {
+	    return false;
+	  }
+	  frame.returned = true;
+	  break;
+	case Nop:
+	case Alias:
+	  break;
+	default:
+	  return false;
+      }
+    }
+    return true;
+  }
+};
+
+//Replaces calls with constant arguments by their result, if they can be evaluated at compile time
+class CallEvaluator:public ConstantFolder {
+public:
+  std::map<std::pair<FunctionNode*,std::vector<int> >,std::pair<bool,int> > results; //Results of previous evaluations (and whether they succeeded)
+  std::set<FunctionNode*> evaluated; //Functions the optimized code depends on (whether or not their evaluation succeeded)
+  bool evaluate(FunctionCallNode* call, int& result) {
+    FunctionNode* func = call->function->function;
+    if(!func || func->isExtern) {
+      return false;
+    }
+    std::vector<int> args;
+    for(size_t i = 0;i<call->args.size();i++) {
+      if(call->args[i]->type != Constant || (((ConstantNode*)call->args[i])->ctype != Integer && ((ConstantNode*)call->args[i])->ctype != Boolean)) {
+	return false;
+      }
+      args.push_back(((ConstantNode*)call->args[i])->i32val);
+    }
+    std::pair<FunctionNode*,std::vector<int> > key(func,args);
+    if(results.find(key) == results.end()) {
+      Evaluator evaluator;
+      evaluator.evaluated = &evaluated;
+      EvaluationFrame frame;
+      results[key].first = evaluator.call(call,frame,results[key].second);
+    }
+    result = results[key].second;
+    return results[key].first;
+  }
+  void post(Expression*& slot) {
+    ConstantFolder::post(slot);
+    FunctionCallNode* call = expression_call(slot);
+    int result;
+    if(call && call->function->function->returnType_resolved && evaluate(call,result)) {
+      replace_constant(slot,result,call->function->function->returnType_resolved);
+    }
+  }
+  //Folds expressions in a block, and removes calls made only for their (nonexistent) side effects
+  void run(std::vector<Node*>& block) {
+    rewrite(block.data(),block.size());
+    prune(block);
+  }
+  void prune(std::vector<Node*>& block) {
+    for(size_t i = 0;i<block.size();i++) {
+      switch(block[i]->type) {
+	case FunctionCall:
+	{
+	  int result;
+	  if(evaluate((FunctionCallNode*)block[i],result)) {
+	    block.erase(block.begin()+i);
+	    i--;
+	  }
+	}
+	  break;
+	case IfStatement:
+	{
+	  IfStatementNode* node = (IfStatementNode*)block[i];
+	  prune(node->instructions_true);
+	  prune(node->instructions_false);
+	}
+	  break;
+	case WhileStatement:
+	  prune(((WhileStatementNode*)block[i])->body);
+	  break;
+      }
+    }
+  }
+};
+
+
+//Deep copy of statements, with fresh labels and declarations
+class Cloner {
+public:
+  std::map<VariableDeclarationNode*,VariableDeclarationNode*> variables; //Declarations which have been copied
+  std::map<VariableDeclarationNode*,int> constants; //Variables to replace with a known value
+  Expression* expression(Expression* exp) {
+    switch(exp->type) {
+      case Constant:
+	return new ConstantNode(*(ConstantNode*)exp);
+      case VariableReference:
+      {
+	VariableReferenceNode* varref = (VariableReferenceNode*)exp;
+	if(varref->variable && constants.find(varref->variable) != constants.end()) {
+	  ConstantNode* constant = make_constant(constants[varref->variable],intern_type(varref->variable->rclass,0));
+	  constant->isReference = varref->isReference;
+	  return constant;
+	}
+	VariableReferenceNode* rval = new VariableReferenceNode(*varref);
+	if(varref->variable && variables.find(varref->variable) != variables.end()) {
+	  rval->variable = variables[varref->variable];
+	}
+	return rval;
+      }
+      case FunctionCall:
+      {
+	FunctionCallNode* rval = new FunctionCallNode(*(FunctionCallNode*)exp);
+	rval->function = new VariableReferenceNode(*rval->function);
+	for(size_t i = 0;i<rval->args.size();i++) {
+	  rval->args[i] = expression(rval->args[i]);
+	}
+	return rval;
+      }
+      case BinaryExpression:
+      {
+	BinaryExpressionNode* rval = new BinaryExpressionNode(*(BinaryExpressionNode*)exp);
+	if(rval->function) {
+	  rval->function = (FunctionCallNode*)expression(rval->function);
+	  sync_operands(rval);
+	}else {
+	  rval->lhs = expression(rval->lhs);
+	  rval->rhs = expression(rval->rhs);
+	}
+	return rval;
+      }
+      case UnaryExpression:
+      {
+	UnaryNode* rval = new UnaryNode(*(UnaryNode*)exp);
+	if(rval->function) {
+	  rval->function = (FunctionCallNode*)expression(rval->function);
+	  sync_operands(rval);
+	}else {
+	  rval->operand = expression(rval->operand);
+	}
+	return rval;
+      }
+    }
+    return 0;
+  }
+  void block(const std::vector<Node*>& nodes, std::vector<Node*>& out) {
+    for(size_t i = 0;i<nodes.size();i++) {
+      out.push_back(node(nodes[i]));
+    }
+  }
+  Node* node(Node* node) {
+    switch(node->type) {
+      case VariableDeclaration:
+      {
+	VariableDeclarationNode* rval = new VariableDeclarationNode(*(VariableDeclarationNode*)node);
+	variables[(VariableDeclarationNode*)node] = rval;
+	if(rval->assignment) {
+	  rval->assignment = (BinaryExpressionNode*)expression(rval->assignment);
+	}
+	return rval;
+      }
+      case UnaryExpression:
+      case BinaryExpression:
+      case FunctionCall:
+	return expression((Expression*)node);
+      case IfStatement:
+      {
+	IfStatementNode* src = (IfStatementNode*)node;
+	IfStatementNode* rval = new IfStatementNode();
+	rval->location = src->location;
+	rval->validated = src->validated;
+	rval->scope_true.parent = src->scope_true.parent;
+	rval->scope_false.parent = src->scope_false.parent;
+	rval->condition = expression(src->condition);
+	block(src->instructions_true,rval->instructions_true);
+	block(src->instructions_false,rval->instructions_false);
+	return rval;
+      }
+      case WhileStatement:
+      {
+	WhileStatementNode* src = (WhileStatementNode*)node;
+	WhileStatementNode* rval = new WhileStatementNode();
+	rval->location = src->location;
+	rval->validated = src->validated;
+	rval->scope.parent = src->scope.parent;
+	if(src->initializer) {
+	  rval->initializer = this->node(src->initializer);
+	}
+	rval->condition = expression(src->condition);
+	block(src->body,rval->body);
+	return rval;
+      }
+      case ReturnStatement:
+      {
+	ReturnStatementNode* rval = new ReturnStatementNode(*(ReturnStatementNode*)node);
+	rval->retval = expression(rval->retval);
+	return rval;
+      }
+      case Nop:
+	return node;
+    }
+    return 0;
+  }
+};
+
+//True if exp only reads the arguments of func and constants, through pure operators
+static bool is_inlinable(Expression* exp, FunctionNode* func) {
+  switch(exp->type) {
+    case Constant:
+      return true;
+    case VariableReference:
+    {
+      VariableDeclarationNode* var = ((VariableReferenceNode*)exp)->variable;
+      return var && !var->isReference && std::find(func->args.begin(),func->args.end(),var) != func->args.end();
+    }
+    case BinaryExpression:
+    case UnaryExpression:
+    {
+      FunctionCallNode* call = expression_call(exp);
+      if(!call || !is_pure(call->function->function)) {
+	return false;
+      }
+      for(size_t i = 0;i<call->args.size();i++) {
+	if(!is_inlinable(call->args[i],func)) {
+	  return false;
+	}
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+//Replaces calls to hot functions (according to the execution profile) which just return a pure expression of their arguments
+//by that expression, when the arguments are constants or variables (so that nothing is evaluated in a different order).
+class HotInliner:public ExpressionRewriter {
+public:
+  FunctionNode* caller = 0;
+  std::set<FunctionNode*> inlined; //Functions whose bodies were copied into the caller
+  void post(Expression*& slot) {
+    if(slot->type != FunctionCall) {
+      return;
+    }
+    FunctionCallNode* call = (FunctionCallNode*)slot;
+    FunctionNode* func = call->function->function;
+    if(!func || !func->hot || func == caller || func->isExtern || func->thisType || func->lambdaCapture || func->operations.size() != 1 || func->operations[0]->type != ReturnStatement) {
+      return;
+    }
+    Expression* retval = ((ReturnStatementNode*)func->operations[0])->retval;
+    if(!retval || retval->returnType != call->returnType || call->args.size() != func->args.size() || !is_inlinable(retval,func)) {
+      return;
+    }
+    Cloner cloner;
+    for(size_t i = 0;i<call->args.size();i++) {
+      VariableDeclarationNode* param = func->args[i];
+      Expression* arg = call->args[i];
+      if(param->isReference || arg->returnType != intern_type(param->rclass,param->pointerLevels)) {
+	return;
+      }
+      if(arg->type == Constant && ((ConstantNode*)arg)->ctype == Integer && !param->pointerLevels && is_builtin(param->rclass,"int")) {
+	cloner.constants[param] = ((ConstantNode*)arg)->i32val;
+      }else if(arg->type == VariableReference && ((VariableReferenceNode*)arg)->variable && !((VariableReferenceNode*)arg)->variable->isReference) {
+	cloner.variables[param] = ((VariableReferenceNode*)arg)->variable;
+      }else {
+	return;
+      }
+    }
+    if(call->isReference && retval->type == VariableReference) {
+      return; //The address of the caller's variable would be taken instead of a copy's
+    }
+    Expression* body = cloner.expression(retval);
+    body->isReference = call->isReference;
+    slot = body;
+    inlined.insert(func);
+  }
+};
+
+static size_t block_cost(Node** nodes, size_t count) {
+  size_t cost = 0;
+  for(size_t i = 0;i<count;i++) {
+    cost++;
+    switch(nodes[i]->type) {
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	cost+=block_cost(node->instructions_true.data(),node->instructions_true.size());
+	cost+=block_cost(node->instructions_false.data(),node->instructions_false.size());
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	cost+=block_cost(node->body.data(),node->body.size());
+      }
+	break;
+    }
+  }
+  return cost;
+}
+
+#define FULL_UNROLL_BUDGET 64 //Maximum number of statements produced by completely unrolling a loop
+
+//Unrolls a for loop with a constant trip count, whose counter (declared by its initializer) is at block[counter].
+//Returns true if the loop was completely unrolled, in which case index is set to the first copy of its body.
+static bool unroll_loop(std::vector<Node*>& block, size_t counter, size_t& index, std::set<VariableDeclarationNode*>& escaped, const CompilerOptions& options) {
+  WhileStatementNode* loop = (WhileStatementNode*)block[index];
+  VariableDeclarationNode* var = (VariableDeclarationNode*)block[counter];
+  if(!var->assignment || var->assignment->rhs->type != Constant || ((ConstantNode*)var->assignment->rhs)->ctype != Integer) {
+    return false;
+  }
+  LoopInfo info;
+  info.escaped = &escaped;
+  info.analyze(loop->condition);
+  info.analyze(loop->body.data(),loop->body.size());
+  if(info.unstructured) {
+    return false;
+  }
+  std::map<VariableDeclarationNode*,InductionVariable> induction;
+  find_induction(loop,info,induction);
+  if(induction.find(var) == induction.end() || !induction[var].step) {
+    return false;
+  }
+  size_t update = induction[var].index;
+  long long step = induction[var].step;
+  //Condition must compare the counter against a constant
+  if(loop->condition->type != BinaryExpression) {
+    return false;
+  }
+  BinaryExpressionNode* condition = (BinaryExpressionNode*)loop->condition;
+  if(!condition->function || !is_pure(condition->function->function->function) || condition->lhs->type != VariableReference || ((VariableReferenceNode*)condition->lhs)->variable != var || condition->rhs->type != Constant || ((ConstantNode*)condition->rhs)->ctype != Integer) {
+    return false;
+  }
+  long long start = ((ConstantNode*)var->assignment->rhs)->i32val;
+  long long limit = ((ConstantNode*)condition->rhs)->i32val;
+  if(condition->op2 && condition->op2 != '=') {
+    return false;
+  }
+  bool strict = !condition->op2;
+  long long trips = 0;
+  switch(condition->op) {
+    case '<':
+      if(step<0) {
+	return false;
+      }
+      if(strict ? start<limit : start<=limit) {
+	trips = strict ? (limit-start+step-1)/step : (limit-start)/step+1;
+      }
+      break;
+    case '>':
+      if(step>0) {
+	return false;
+      }
+      if(strict ? start>limit : start>=limit) {
+	trips = strict ? (start-limit-step-1)/-step : (start-limit)/-step+1;
+      }
+      break;
+    default:
+      return false;
+  }
+  long long last = start+trips*step;
+  if(last>2147483647LL || last<(-2147483647LL-1)) {
+    return false; //Counter would overflow
+  }
+  std::vector<Node*> original = loop->body;
+  std::vector<Node*> unrolled;
+  size_t cost = block_cost(original.data(),original.size());
+  if((size_t)trips*cost <= FULL_UNROLL_BUDGET) {
+    //Replace loop with one copy of the body per iteration, with the counter replaced by its value
+    for(long long i = 0;i<trips;i++) {
+      Cloner cloner;
+      cloner.constants[var] = (int)(start+i*step);
+      for(size_t c = 0;c<original.size();c++) {
+	if(c != update) {
+	  unrolled.push_back(cloner.node(original[c]));
+	}
+      }
+    }
+    ConstantFolder folder;
+    folder.rewrite(unrolled.data(),unrolled.size());
+    block.erase(block.begin()+index);
+    block.insert(block.begin()+index,unrolled.begin(),unrolled.end());
+    block.erase(block.begin()+counter);
+    index--;
+    return true;
+  }
+  long long factor = options.unroll;
+  if(factor<2 || trips<factor) {
+    return false;
+  }
+  for(long long i = 1;i<factor;i++) {
+    Cloner cloner;
+    cloner.block(original,loop->body);
+  }
+  //Main loop runs while a whole group of iterations remains
+  long long bound = start+(trips-trips%factor)*step;
+  if(!strict && (bound-step>2147483647LL || bound-step<(-2147483647LL-1))) {
+    return false;
+  }
+  ConstantNode* constant = make_constant((int)(strict ? bound : bound-step),condition->rhs->returnType);
+  constant->isReference = condition->rhs->isReference;
+  condition->function->args[0] = constant;
+  sync_operands(condition);
+  //Remainder
+  for(long long i = 0;i<trips%factor;i++) {
+    Cloner cloner;
+    cloner.block(original,unrolled);
+  }
+  block.insert(block.begin()+index+1,unrolled.begin(),unrolled.end());
+  return false;
+}
+
+class LoopOptimizer:public ExpressionRewriter {
+public:
+  LoopInfo info;
+  WhileStatementNode* loop;
+  FunctionNode* function;
+  bool strengthReduce; //Multiplication and addition are both extern calls on UVM, so this only pays off with cheaper host arithmetic (-O2)
+  bool reducing = false; //Currently performing strength reduction (otherwise hoisting invariants)
+  std::vector<Node*> preheader; //Nodes to insert before the loop
+  std::map<VariableDeclarationNode*,InductionVariable> induction;
+  std::map<std::pair<VariableDeclarationNode*,int>,VariableDeclarationNode*> reduced; //(variable, factor) -> running product
+  std::vector<std::pair<size_t,Node*> > updates; //Statements to insert after induction variable updates
+
+  //Replaces v*c (or c*v) for an induction variable v with a running product updated alongside v.
+  bool reduce(Expression*& slot) {
+    if(slot->type != BinaryExpression) {
+      return false;
+    }
+    BinaryExpressionNode* bexp = (BinaryExpressionNode*)slot;
+    if(!bexp->function || bexp->op != '*' || bexp->op2 || !is_pure(bexp->function->function->function)) {
+      return false;
+    }
+    Expression* var = bexp->lhs;
+    Expression* factor = bexp->rhs;
+    if(var->type != VariableReference) {
+      var = bexp->rhs;
+      factor = bexp->lhs;
+    }
+    if(var->type != VariableReference || factor->type != Constant || ((ConstantNode*)factor)->ctype != Integer) {
+      return false;
+    }
+    VariableDeclarationNode* v = ((VariableReferenceNode*)var)->variable;
+    if(!v || induction.find(v) == induction.end() || v->rclass != bexp->returnType->type) {
+      return false;
+    }
+    int c = ((ConstantNode*)factor)->i32val;
+    std::pair<VariableDeclarationNode*,int> key(v,c);
+    VariableDeclarationNode* product;
+    if(reduced.find(key) == reduced.end()) {
+      BinaryExpressionNode* init = make_operator("*",make_reference(v),make_constant(c,bexp->returnType));
+      if(!init) {
+	return false;
+      }
+      product = make_temporary(init,function);
+      int increment = (int)((unsigned int)c*(unsigned int)induction[v].step);
+      BinaryExpressionNode* next = make_operator("+",make_reference(product),make_constant(increment,bexp->returnType));
+      if(!next) {
+	return false;
+      }
+      preheader.push_back(product);
+      updates.push_back(std::pair<size_t,Node*>(induction[v].index,make_assignment(product,next)));
+      reduced[key] = product;
+    }
+    product = reduced[key];
+    bool isReference = slot->isReference;
+    slot = make_reference(product);
+    slot->isReference = isReference;
+    return true;
+  }
+  //Moves loop-invariant pure operator calls into the preheader.
+  bool hoist(Expression*& slot) {
+    if(!expression_call(slot) || !info.invariant(slot)) {
+      return false;
+    }
+    VariableDeclarationNode* temp = make_temporary(slot,function);
+    preheader.push_back(temp);
+    bool isReference = slot->isReference;
+    slot->isReference = false;
+    slot = make_reference(temp);
+    slot->isReference = isReference;
+    return true;
+  }
+  bool replace(Expression*& slot) {
+    return reducing ? reduce(slot) : hoist(slot);
+  }
+  void run() {
+    info.analyze(loop->condition);
+    info.analyze(loop->body.data(),loop->body.size());
+    if(info.unstructured) {
+      return;
+    }
+    find_induction(loop,info,induction);
+    if(strengthReduce && induction.size()) {
+      reducing = true;
+      rewrite(loop->condition);
+      rewrite(loop->body.data(),loop->body.size());
+      reducing = false;
+      for(size_t i = loop->body.size();i>0;i--) {
+	for(size_t c = 0;c<updates.size();c++) {
+	  if(updates[c].first == i-1) {
+	    loop->body.insert(loop->body.begin()+i,updates[c].second);
+	  }
+	}
+      }
+      //Running products are now written inside the loop
+      for(size_t i = 0;i<updates.size();i++) {
+	info.write(((VariableReferenceNode*)((BinaryExpressionNode*)updates[i].second)->lhs)->variable);
+      }
+    }
+    rewrite(loop->condition);
+    rewrite(loop->body.data(),loop->body.size());
+  }
+};
+
+static void optimize_function(std::vector<Node*>& block, FunctionNode* function, std::vector<FunctionNode*>& evaluated, const CompilerOptions& options);
+
+static void optimize_block(std::vector<Node*>& block, FunctionNode* function, std::set<VariableDeclarationNode*>& escaped, const CompilerOptions& options) {
+  for(size_t i = 0;i<block.size();i++) {
+    switch(block[i]->type) {
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)block[i];
+	optimize_block(node->instructions_true,function,escaped,options);
+	optimize_block(node->instructions_false,function,escaped,options);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)block[i];
+	//The initializer runs once, so it becomes part of the preheader
+	size_t counter = -1;
+	if(node->initializer) {
+	  if(node->initializer->type == VariableDeclaration) {
+	    counter = i;
+	  }
+	  block.insert(block.begin()+i,node->initializer);
+	  node->initializer = 0;
+	  i++;
+	}
+	if(options.optimize >= 2 && counter != (size_t)-1 && unroll_loop(block,counter,i,escaped,options)) {
+	  //The copies of the body are optimized as part of this block
+	  i--;
+	  break;
+	}
+	LoopOptimizer loop;
+	loop.loop = node;
+	loop.function = function;
+	loop.info.escaped = &escaped;
+	loop.strengthReduce = options.optimize >= 2;
+	loop.run();
+	block.insert(block.begin()+i,loop.preheader.begin(),loop.preheader.end());
+	i+=loop.preheader.size();
+	//Inner loops are optimized after the outer loop has hoisted everything invariant in it
+	optimize_block(node->body,function,escaped,options);
+      }
+	break;
+      case Function:
+      {
+	FunctionNode* func = (FunctionNode*)block[i];
+	if(!func->isExtern && !func->optimized) {
+	  optimize_function(func->operations,func,func->evaluated,options);
+	}
+      }
+	break;
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)block[i];
+	if(cls->init) {
+	  optimize_function(cls->init->operations,0,cls->init->evaluated,options);
+	}
+      }
+	break;
+    }
+  }
+}
+
+//Functions evaluated at compile time are added to evaluated, as the optimized code depends on their bodies
+static void optimize_function(std::vector<Node*>& block, FunctionNode* function, std::vector<FunctionNode*>& evaluated, const CompilerOptions& options) {
+  if(options.profile) {
+    HotInliner inliner;
+    inliner.caller = function;
+    inliner.rewrite(block.data(),block.size());
+    evaluated.insert(evaluated.end(),inliner.inlined.begin(),inliner.inlined.end());
+  }
+  std::set<VariableDeclarationNode*> escaped;
+  find_escaped(block.data(),block.size(),escaped);
+  CallEvaluator evaluator;
+  evaluator.run(block);
+  evaluated.insert(evaluated.end(),evaluator.evaluated.begin(),evaluator.evaluated.end());
+  if(function) {
+    function->optimized = true;
+  }
+  optimize_block(block,function,escaped,options);
+}
+
+
+//Optimize a validated program in place
+void optimize(std::vector<Node*>& instructions, const CompilerOptions& options, std::vector<FunctionNode*>* evaluated) {
+  if(!options.optimize) {
+    return;
+  }
+  PhaseTimer timer("optimize");
+  std::vector<FunctionNode*> functions;
+  optimize_function(instructions,0,evaluated ? *evaluated : functions,options);
+}
+
+//Optimize a single validated function in place (when the rest of the program has already been optimized)
+void optimize(FunctionNode* function, const CompilerOptions& options) {
+  if(!options.optimize || function->isExtern) {
+    return;
+  }
+  PhaseTimer timer("optimize");
+  optimize_function(function->operations,function,function->evaluated,options);
+}
@@ -0,0 +1,85 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef OPTIONS_HEADER
+#define OPTIONS_HEADER
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+//Generated code of functions, kept in memory between compilations of a program (see Session)
+class UnitCache {
+public:
+  std::map<std::string,std::string> entries; //Cache entries (in the format of the --cache directory), by key
+  std::set<std::string> used; //Keys looked up or added since the cache was last pruned
+  void prune() {
+    for(auto entry = entries.begin();entry != entries.end();) {
+      if(used.find(entry->first) == used.end()) {
+	entry = entries.erase(entry);
+      }else {
+	entry++;
+      }
+    }
+    used.clear();
+  }
+};
+
+//A function (or top-level code, or a class initializer) in a linked image
+class CodeSymbol {
+public:
+  std::string name; //Mangled name
+  uint64_t start; //Offset of the code in the image
+  uint64_t end;
+};
+
+//An entry of the import table of a linked image
+class ImageImport {
+public:
+  std::string name; //Mangled name
+  bool isExternal; //Provided by the runtime
+  int argcount;
+  int outsize;
+  uint64_t offset; //Start of the function, relative to the start of the code (if defined in the image)
+};
+
+//Where the code in a linked image came from (see write_line_table and disassemble)
+class LineTable {
+public:
+  std::vector<std::pair<uint64_t,uint32_t> > locations; //Offset in the image at which the code of a statement starts, and the statement's location (see Node::location)
+  std::vector<CodeSymbol> symbols; //In image order
+  std::vector<ImageImport> imports;
+  uint64_t codeStart = 0; //Offset of the code in the image (after the import table)
+  uint64_t codeEnd = 0; //End of the code (start of the data section, if any)
+};
+
+//Counts read from the profile of an instrumented image (see profile.h and read_profile)
+class Profile {
+public:
+  std::map<std::string,std::vector<uint64_t> > units; //Counters of each unit, by mangled name
+};
+
+class CompilerOptions {
+public:
+  int optimize = 0; //Optimization level (-O0 disables all optimization passes, -O2 enables strength reduction and loop unrolling)
+  int unroll = 4; //Number of copies of a loop body per iteration when partially unrolling
+  int jobs = 0; //Number of code generation threads (0 for one per core)
+  const char* cache = 0; //Directory in which generated function code is cached (or 0 to disable caching)
+  UnitCache* units = 0; //In-memory cache of generated function code (or 0)
+  bool dataSection = false; //Place string literals and constant top-level variables in a data section appended to the image (see gencode). Images with a data section need a runtime providing __uvm_intrinsic_dataptr.
+  bool instrument = false; //Count executions of functions and branches, and hand the counts to the runtime when the program finishes (see profile.h). The counters live in the data section.
+  bool trace = false; //Call the tracing runtime on entry to and exit from every function (see trace.h)
+  const Profile* profile = 0; //Execution profile to optimize the program for (or 0). The caches aren't used while it is set, as it changes the code of functions.
+  LineTable* lines = 0; //Receives the source locations of the generated image (or 0). The caches aren't used while it is set, as cached code has no locations.
+};
+
+#endif
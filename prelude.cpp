@@ -0,0 +1,299 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Precompiled preludes (--emit-prelude and --prelude)
+//A precompiled prelude holds validated class, alias and extern function declarations, in declaration order.
+//It is memory mapped when loaded, and names are referenced in place rather than copied.
+
+#include <stdio.h>
+#include "tree.h"
+#include "vpp.h"
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define PRELUDE_MAGIC "VPRE"
+#define PRELUDE_VERSION 1
+
+class PreludeWriter {
+public:
+  std::string out;
+  void write(uint64_t value) {
+    out.append((const char*)&value,sizeof(value));
+  }
+  void write(const std::string& value) {
+    write(value.size());
+    out+=value;
+  }
+  bool function(FunctionNode* func) {
+    if(!func->isExtern) {
+      report(func,"%s: Only extern functions can be precompiled",((std::string)func->name).data());
+      return false;
+    }
+    write(Function);
+    write(func->name);
+    write(func->mangle());
+    write(func->returnType);
+    write(func->returnType_pointerLevels);
+    write(func->args.size());
+    for(size_t i = 0;i<func->args.size();i++) {
+      write(func->args[i]->name);
+      write(func->args[i]->vartype);
+      write(func->args[i]->pointerLevels);
+    }
+    return true;
+  }
+};
+
+//Writes the declarations of a validated prelude
+bool write_prelude(Node** nodes, size_t count, ScopeNode* scope, const char* filename) {
+  PreludeWriter writer;
+  writer.out = PRELUDE_MAGIC;
+  writer.write(PRELUDE_VERSION);
+  writer.write(count);
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)nodes[i];
+	writer.write(Class);
+	writer.write(cls->name);
+	writer.write(cls->align);
+	writer.write(cls->size);
+	writer.write(cls->instructions.size());
+	for(size_t c = 0;c<cls->instructions.size();c++) {
+	  if(cls->instructions[c]->type != Function) {
+	    report(cls->instructions[c],"%s: Only extern functions can be precompiled",((std::string)cls->name).data());
+	    return false;
+	  }
+	  if(!writer.function((FunctionNode*)cls->instructions[c])) {
+	    return false;
+	  }
+	}
+      }
+	break;
+      case Function:
+	if(!writer.function((FunctionNode*)nodes[i])) {
+	  return false;
+	}
+	break;
+      case Alias:
+      {
+	//Aliases don't know their own name
+	for(auto token = scope->tokens.begin();token != scope->tokens.end();token++) {
+	  if(token->second == nodes[i]) {
+	    writer.write(Alias);
+	    writer.write(token->first);
+	    writer.write(((AliasNode*)nodes[i])->dest);
+	  }
+	}
+      }
+	break;
+      default:
+	report(nodes[i],"A precompiled prelude can only contain classes, aliases and extern functions");
+	return false;
+    }
+  }
+  FILE* file = fopen(filename,"wb");
+  if(!file) {
+    report(0,"%s: Unable to write file",filename);
+    return false;
+  }
+  bool written = fwrite(writer.out.data(),1,writer.out.size(),file) == writer.out.size();
+  written &= fclose(file) == 0;
+  if(!written) {
+    report(0,"%s: Unable to write file",filename);
+  }
+  return written;
+}
+
+class PreludeReader {
+public:
+  const unsigned char* ptr;
+  const unsigned char* end;
+  ScopeNode* root;
+  std::vector<FunctionNode*> functions; //Types are resolved once every class has been loaded
+  bool failed = false;
+  uint64_t read() {
+    uint64_t value = 0;
+    if((size_t)(end-ptr)<sizeof(value)) {
+      failed = true;
+      return 0;
+    }
+    memcpy(&value,ptr,sizeof(value));
+    ptr+=sizeof(value);
+    return value;
+  }
+  StringRef string() {
+    uint64_t size = read();
+    if((uint64_t)(end-ptr)<size) {
+      failed = true;
+      return StringRef();
+    }
+    StringRef rval((const char*)ptr,size);
+    ptr+=size;
+    return rval;
+  }
+  ClassNode* resolveClass(const StringRef& name) {
+    Node* n = root->resolve(name);
+    if(!n || n->type != Class) {
+      failed = true;
+      return 0;
+    }
+    return (ClassNode*)n;
+  }
+  //Functions are declared in scope, with overloads chained as the parser does
+  FunctionNode* function(ScopeNode* scope, ClassNode* thisType) {
+    FunctionNode* func = new FunctionNode(scope);
+    func->isExtern = true;
+    func->thisType = thisType;
+    func->name = string();
+    func->scope.name = func->name;
+    func->mangled_name = (std::string)string();
+    func->returnType = string();
+    func->returnType_pointerLevels = read();
+    size_t argcount = read();
+    for(size_t i = 0;i<argcount && !failed;i++) {
+      VariableDeclarationNode* vardec = new VariableDeclarationNode();
+      vardec->function = func;
+      vardec->name = string();
+      vardec->vartype = string();
+      vardec->pointerLevels = read();
+      vardec->validated = true;
+      func->scope.add(vardec->name,vardec);
+      func->args.push_back(vardec);
+    }
+    functions.push_back(func);
+    func->isDeclared = true;
+    func->validated = true;
+    if(!scope->add(func->name,func)) {
+      FunctionNode* onode = (FunctionNode*)scope->resolve(func->name);
+      //Add overload
+      func->nextOverload = onode->nextOverload;
+      onode->nextOverload = func;
+    }
+    return func;
+  }
+  void resolveTypes() {
+    for(size_t i = 0;i<functions.size() && !failed;i++) {
+      FunctionNode* func = functions[i];
+      for(size_t c = 0;c<func->args.size();c++) {
+	func->args[c]->rclass = resolveClass(func->args[c]->vartype);
+      }
+      if(func->returnType.count) {
+	ClassNode* type = resolveClass(func->returnType);
+	if(type) {
+	  func->returnType_resolved = intern_type(type,func->returnType_pointerLevels);
+	}
+      }
+    }
+  }
+};
+
+//Maps a precompiled prelude into memory. The mapping is never released, since loaded declarations refer to it.
+const unsigned char* map_prelude(const char* filename, size_t* size) {
+  struct stat us;
+  int fd = open(filename,O_RDONLY);
+  if(fd<0 || fstat(fd,&us)) {
+    report(0,"%s: Unable to read file",filename);
+    return 0;
+  }
+  void* mapping = mmap(0,us.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    report(0,"%s: Unable to read file",filename);
+    return 0;
+  }
+  *size = us.st_size;
+  return (const unsigned char*)mapping;
+}
+
+//Loads a mapped prelude into root, and adds its declarations to instructions.
+//The same mapping can be loaded any number of times; each load creates its own nodes.
+bool load_prelude(const char* filename, const unsigned char* data, size_t size, ScopeNode* root, std::vector<Node*>& instructions) {
+  PreludeReader reader;
+  reader.ptr = data;
+  reader.end = data+size;
+  reader.root = root;
+  if(size<4 || memcmp(reader.ptr,PRELUDE_MAGIC,4)) {
+    report(0,"%s: Not a precompiled prelude",filename);
+    return false;
+  }
+  reader.ptr+=4;
+  if(reader.read() != PRELUDE_VERSION) {
+    report(0,"%s: Unsupported prelude version",filename);
+    return false;
+  }
+  size_t count = reader.read();
+  for(size_t i = 0;i<count && !reader.failed;i++) {
+    switch(reader.read()) {
+      case Class:
+      {
+	ClassNode* cls = new ClassNode();
+	cls->name = reader.string();
+	cls->scope.name = cls->name;
+	cls->scope.parent = root;
+	cls->align = reader.read();
+	cls->size = reader.read();
+	if(!root->add(cls->name,cls)) {
+	  reader.failed = true;
+	  break;
+	}
+	size_t members = reader.read();
+	for(size_t c = 0;c<members && !reader.failed;c++) {
+	  if(reader.read() != Function) {
+	    reader.failed = true;
+	    break;
+	  }
+	  cls->instructions.push_back(reader.function(&cls->scope,cls));
+	}
+	//What validateClass would have created
+	FunctionNode* init = new FunctionNode(&cls->scope);
+	init->name = ".init";
+	init->operations = cls->instructions;
+	init->isDeclared = true;
+	init->validated = true;
+	cls->init = init;
+	cls->validated = true;
+	instructions.push_back(cls);
+      }
+	break;
+      case Function:
+	instructions.push_back(reader.function(root,0));
+	break;
+      case Alias:
+      {
+	StringRef name = reader.string();
+	AliasNode* alias = new AliasNode();
+	alias->dest = reader.string();
+	alias->validated = true;
+	if(!root->add(name,alias)) {
+	  reader.failed = true;
+	}
+	instructions.push_back(alias);
+      }
+	break;
+      default:
+	reader.failed = true;
+	break;
+    }
+  }
+  reader.resolveTypes();
+  if(reader.failed) {
+    report(0,"%s: Invalid precompiled prelude",filename);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,150 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+//Profile-guided optimization (--profile-use)
+//
+//Counts from a profile written by an instrumented image (see profile.h) are attached to the tree after validation.
+//Units are matched by mangled name, and their branches by position, so the profile of a function still applies
+//after unrelated code has changed; a unit whose number of branches has changed is ignored. The counts are used to:
+//  - inline hot functions whose body is a single pure expression (see optimize.cpp)
+//  - lay out each if statement so that the branch taken most often falls through (see emit.cpp)
+//  - group the code of hot functions after the top-level code, and move code that never ran to the end of the image
+
+#include "tree.h"
+#include "vpp.h"
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+
+bool read_profile(const char* filename, Profile& profile) {
+  FILE* file = fopen(filename,"rb");
+  if(!file) {
+    report(0,"%s: Unable to read file",filename);
+    return false;
+  }
+  std::vector<uint64_t> words;
+  uint64_t word;
+  while(fread(&word,sizeof(word),1,file) == 1) {
+    words.push_back(word);
+  }
+  fclose(file);
+  if(words.size()<3 || words[0] != PROFILE_MAGIC) {
+    report(0,"%s: Not a profile",filename);
+    return false;
+  }
+  uint64_t units = words[1];
+  uint64_t total = words[2];
+  size_t header = 3;
+  std::vector<std::pair<std::string,std::pair<uint64_t,uint64_t> > > ranges;
+  for(uint64_t i = 0;i<units;i++) {
+    if(words.size()-header<3) {
+      report(0,"%s: Truncated profile",filename);
+      return false;
+    }
+    uint64_t first = words[header];
+    uint64_t count = words[header+1];
+    uint64_t length = words[header+2];
+    header+=3;
+    if(length/8 >= words.size()-header || first > total || count > total-first) {
+      report(0,"%s: Truncated profile",filename);
+      return false;
+    }
+    ranges.push_back(std::make_pair(std::string((const char*)(words.data()+header),length),std::make_pair(first,count)));
+    header+=(length+7)/8;
+  }
+  if(words.size()-header<total) {
+    report(0,"%s: Truncated profile",filename);
+    return false;
+  }
+  for(size_t i = 0;i<ranges.size();i++) {
+    const uint64_t* counters = words.data()+header+ranges[i].second.first;
+    profile.units[ranges[i].first].assign(counters,counters+ranges[i].second.second);
+  }
+  return true;
+}
+
+//Lists the if and while statements of a block in pre-order (in the order of their counters)
+static void collect_branches(Node** nodes, size_t count, std::vector<Node*>& branches) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	branches.push_back(node);
+	collect_branches(node->instructions_true.data(),node->instructions_true.size(),branches);
+	collect_branches(node->instructions_false.data(),node->instructions_false.size(),branches);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	branches.push_back(node);
+	collect_branches(node->body.data(),node->body.size(),branches);
+      }
+	break;
+    }
+  }
+}
+
+//Annotates a unit (and the units it contains, as listed by collect_units in emit.cpp) with its counts
+static void annotate_unit(Node** nodes, size_t count, FunctionNode* function, const std::string& name, const Profile& profile, std::vector<FunctionNode*>& functions) {
+  auto unit = profile.units.find(name);
+  std::vector<Node*> branches;
+  collect_branches(nodes,count,branches);
+  if(unit != profile.units.end() && unit->second.size() == 1+branches.size()*2) {
+    const std::vector<uint64_t>& counters = unit->second;
+    if(function) {
+      function->executions = counters[0];
+      functions.push_back(function);
+    }
+    for(size_t i = 0;i<branches.size();i++) {
+      if(branches[i]->type != IfStatement) {
+	continue; //Loop bodies already fall through from the condition
+      }
+      uint64_t taken = counters[1+i*2];
+      uint64_t skipped = counters[2+i*2];
+      ((IfStatementNode*)branches[i])->likely = taken > skipped ? 1 : skipped > taken ? -1 : 0;
+    }
+  }
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)nodes[i];
+	if(cls->init && cls->init->operations.size()) {
+	  annotate_unit(cls->init->operations.data(),cls->init->operations.size(),cls->init,cls->scope.mangle(),profile,functions);
+	}
+      }
+	break;
+      case Function:
+      {
+	FunctionNode* func = (FunctionNode*)nodes[i];
+	if(!func->isExtern) {
+	  annotate_unit(func->operations.data(),func->operations.size(),func,func->mangle(),profile,functions);
+	}
+      }
+	break;
+    }
+  }
+}
+
+void apply_profile(std::vector<Node*>& instructions, ScopeNode* root, const Profile& profile) {
+  std::vector<FunctionNode*> functions;
+  annotate_unit(instructions.data(),instructions.size(),0,root->mangle(),profile,functions);
+  uint64_t hottest = 0;
+  for(size_t i = 0;i<functions.size();i++) {
+    if((uint64_t)functions[i]->executions > hottest) {
+      hottest = functions[i]->executions;
+    }
+  }
+  for(size_t i = 0;i<functions.size();i++) {
+    functions[i]->hot = functions[i]->executions && (uint64_t)functions[i]->executions*PROFILE_HOT >= hottest;
+  }
+}
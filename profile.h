@@ -0,0 +1,45 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Execution profiles (--instrument)
+
+#ifndef PROFILE_HEADER
+#define PROFILE_HEADER
+#include <stdint.h>
+
+//An instrumented image counts how often each function is entered and each branch is taken, in a profile area in its data
+//section. When the top-level code finishes, it passes the area to the runtime through an extern:
+//  __vpp_profile_write(profile pointer, size in bytes)
+//which saves it (verbatim) as the profile of the run. The area is made of little-endian 64-bit words:
+//
+//  PROFILE_MAGIC
+//  Number of units, number of counters
+//  For each unit (top-level code, class initializers and functions, in image order):
+//    index of its first counter, number of counters, name length, mangled name (padded to 8 bytes)
+//  Counters
+//
+//The first counter of a unit counts its executions. It is followed by two counters for each if and while statement
+//in the unit's body, in pre-order: the number of times the true and false branches of the if statement were taken,
+//or the number of times the body of the loop was entered and the loop was left.
+//A host running instrumented images binds __vpp_profile_write to profile_write (in the vppprofile library), which
+//saves the area to the file set with profile_output.
+#define PROFILE_MAGIC 0x31464f5250505600ULL //"\0VPPROF1"
+#define PROFILE_HOT 100 //A function is hot if it is called at least 1/PROFILE_HOT as often as the most called function (--profile-use)
+#define PROFILE_FILENAME "vpp.profile" //Where profile_write saves the profile until profile_output is called
+
+//Sets the file profile_write saves profiles to
+void profile_output(const char* filename);
+//Saves the profile area of an instrumented image (size bytes at area), replacing the previous profile
+void profile_write(const void* area, uint64_t size);
+//Saves a profile area to filename, returning false if it can't be written
+bool profile_save(const char* filename, const void* area, uint64_t size);
+
+#endif
@@ -0,0 +1,38 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Profile runtime (--instrument)
+
+#include "profile.h"
+#include <stdio.h>
+#include <string>
+
+static std::string outputFilename = PROFILE_FILENAME;
+
+void profile_output(const char* filename) {
+  outputFilename = filename;
+}
+
+bool profile_save(const char* filename, const void* area, uint64_t size) {
+  FILE* file = fopen(filename,"wb");
+  if(!file) {
+    return false;
+  }
+  bool written = fwrite(area,1,size,file) == size;
+  written &= fclose(file) == 0;
+  return written;
+}
+
+void profile_write(const void* area, uint64_t size) {
+  if(!profile_save(outputFilename.data(),area,size)) {
+    fprintf(stderr,"%s: Unable to write profile\n",outputFilename.data());
+  }
+}
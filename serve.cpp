@@ -0,0 +1,132 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Compile server (--serve)
+//Clients connect to a Unix domain socket, write a source file and shut down their side of the connection.
+//The server replies with a status byte (0 on success) followed by the linked image, or by the diagnostics if the program is invalid.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vpp.h"
+
+//Reads a request until the client shuts down its side of the connection
+static bool read_request(int fd, std::string& source) {
+  char buffer[4096];
+  while(true) {
+    ssize_t processed = read(fd,buffer,sizeof(buffer));
+    if(processed == 0) {
+      return true;
+    }
+    if(processed<0) {
+      if(errno == EINTR) {
+	continue;
+      }
+      return false;
+    }
+    source.append(buffer,processed);
+  }
+}
+
+static void send_response(int fd, unsigned char status, const void* data, size_t len) {
+  if(send(fd,&status,1,MSG_NOSIGNAL) != 1) {
+    return;
+  }
+  const char* ptr = (const char*)data;
+  while(len) {
+    ssize_t processed = send(fd,ptr,len,MSG_NOSIGNAL);
+    if(processed<=0) {
+      if(processed<0 && errno == EINTR) {
+	continue;
+      }
+      break;
+    }
+    len-=processed;
+    ptr+=processed;
+  }
+}
+
+//Accepts and compiles requests until the socket is closed. Runs on every thread of the pool, each with its own Compiler
+//(which keeps the validated prelude loaded, and reuses the memory of the previous request).
+static void serve_requests(int listener, Compiler* compiler) {
+  std::vector<unsigned char> image;
+  while(true) {
+    int fd = accept(listener,0,0);
+    if(fd<0) {
+      if(errno == EINTR || errno == ECONNABORTED) {
+	continue;
+      }
+      break;
+    }
+    std::string source;
+    if(read_request(fd,source)) {
+      if(compiler->compile("request",source.data(),source.size(),image)) {
+	send_response(fd,0,image.data(),image.size());
+      }else {
+	std::string log;
+	for(size_t i = 0;i<compiler->errors.size();i++) {
+	  log+=compiler->errors[i].msg+"\n";
+	}
+	send_response(fd,1,log.data(),log.size());
+      }
+    }
+    close(fd);
+  }
+}
+
+int serve(const char* path, const char* prelude, const CompilerOptions& options) {
+  sockaddr_un address;
+  memset(&address,0,sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(address.sun_path)) {
+    printf("%s: Socket path is too long\n",path);
+    return 1;
+  }
+  strcpy(address.sun_path,path);
+  size_t threads = options.jobs ? options.jobs : std::thread::hardware_concurrency();
+  std::vector<Compiler*> compilers;
+  for(size_t i = 0;i<threads;i++) {
+    Compiler* compiler = new Compiler();
+    compiler->options = options;
+    //Each worker loads and validates the prelude once, and reuses it for every request
+    if(prelude && !compiler->loadPrelude(prelude)) {
+      for(size_t c = 0;c<compiler->errors.size();c++) {
+	printf("%s\n",compiler->errors[c].msg.data());
+      }
+      return 1;
+    }
+    compilers.push_back(compiler);
+  }
+  int listener = socket(AF_UNIX,SOCK_STREAM,0);
+  unlink(path);
+  if(listener<0 || bind(listener,(sockaddr*)&address,sizeof(address)) || listen(listener,SOMAXCONN)) {
+    printf("%s: Unable to listen on socket\n",path);
+    return 1;
+  }
+  signal(SIGPIPE,SIG_IGN);
+  std::vector<std::thread> pool;
+  for(size_t i = 1;i<threads;i++) {
+    pool.push_back(std::thread(serve_requests,listener,compilers[i]));
+  }
+  serve_requests(listener,compilers[0]);
+  for(size_t i = 0;i<pool.size();i++) {
+    pool[i].join();
+  }
+  close(listener);
+  return 0;
+}
@@ -0,0 +1,528 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Incremental compilation (Session)
+//A Session keeps a validated and optimized program in memory between compilations. When the only changes to a file
+//are to the bodies of top-level functions, just the changed functions are parsed into the program, validated and optimized,
+//along with the functions whose optimized code depended on them. Other functions only have their references to the
+//changed functions updated, and their code comes from an in-memory cache. Any other change rebuilds the program.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "tree.h"
+#include "vpp.h"
+#include "arena.h"
+#include "sha256.h"
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+
+unsigned char* gencode(Node** nodes, size_t count, ScopeNode* scope, size_t* sz, const CompilerOptions& options);
+void optimize(std::vector<Node*>& instructions, const CompilerOptions& options, std::vector<FunctionNode*>* evaluated = 0);
+void optimize(FunctionNode* function, const CompilerOptions& options);
+
+//Structure of a parsed (not yet validated) tree, used to find the declarations that changed between two versions of a file
+class Fingerprint {
+public:
+  std::string data;
+  void write(uint64_t value) {
+    data.append((const char*)&value,sizeof(value));
+  }
+  void write(const std::string& value) {
+    write(value.size());
+    data+=value;
+  }
+  void write(const StringRef& value) {
+    write((std::string)value);
+  }
+  void signature(FunctionNode* func) {
+    write(func->name);
+    write(func->isExtern);
+    write(func->returnType);
+    write(func->returnType_pointerLevels);
+    write(func->args.size());
+    for(size_t i = 0;i<func->args.size();i++) {
+      node(func->args[i]);
+    }
+  }
+  void block(std::vector<Node*>& nodes) {
+    write(nodes.size());
+    for(size_t i = 0;i<nodes.size();i++) {
+      node(nodes[i]);
+    }
+  }
+  void node(Node* node) {
+    if(!node) {
+      write(-1);
+      return;
+    }
+    write(node->type);
+    switch(node->type) {
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)node;
+	write(cls->name);
+	write(cls->align);
+	write(cls->size);
+	block(cls->instructions);
+      }
+	break;
+      case VariableDeclaration:
+      {
+	VariableDeclarationNode* var = (VariableDeclarationNode*)node;
+	write(var->vartype);
+	write(var->name);
+	write(var->pointerLevels);
+	this->node(var->assignment);
+      }
+	break;
+      case Constant:
+      {
+	ConstantNode* constant = (ConstantNode*)node;
+	write(constant->ctype);
+	write(constant->value);
+	if(constant->ctype == String) {
+	  write(constant->strval);
+	}else {
+	  write(constant->i32val);
+	}
+      }
+	break;
+      case BinaryExpression:
+      {
+	BinaryExpressionNode* exp = (BinaryExpressionNode*)node;
+	write(exp->op);
+	write(exp->op2);
+	this->node(exp->lhs);
+	this->node(exp->rhs);
+      }
+	break;
+      case UnaryExpression:
+      {
+	UnaryNode* exp = (UnaryNode*)node;
+	write(exp->op);
+	write(exp->op2);
+	this->node(exp->operand);
+      }
+	break;
+      case VariableReference:
+	write(((VariableReferenceNode*)node)->id);
+	break;
+      case FunctionCall:
+      {
+	FunctionCallNode* call = (FunctionCallNode*)node;
+	this->node(call->function);
+	write(call->args.size());
+	for(size_t i = 0;i<call->args.size();i++) {
+	  this->node(call->args[i]);
+	}
+      }
+	break;
+      case Function:
+      {
+	FunctionNode* func = (FunctionNode*)node;
+	signature(func);
+	block(func->operations);
+      }
+	break;
+      case IfStatement:
+      {
+	IfStatementNode* statement = (IfStatementNode*)node;
+	this->node(statement->condition);
+	block(statement->instructions_true);
+	block(statement->instructions_false);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* statement = (WhileStatementNode*)node;
+	this->node(statement->initializer);
+	this->node(statement->condition);
+	block(statement->body);
+      }
+	break;
+      case ReturnStatement:
+	this->node(((ReturnStatementNode*)node)->retval);
+	break;
+      case Goto:
+	write(((GotoNode*)node)->target);
+	break;
+      case Label:
+	write(((LabelNode*)node)->name);
+	break;
+      case Alias:
+	write(((AliasNode*)node)->dest);
+	break;
+    }
+  }
+};
+
+class SessionFile {
+public:
+  SourceFile source;
+  size_t size = 0; //Length of the source code
+  std::string declarations; //Fingerprint of everything in the file except the bodies of top-level functions
+  std::vector<FunctionNode*> functions; //Top-level functions with bodies, in order
+  std::vector<std::string> fingerprints; //Fingerprint of each function
+};
+
+//A version of the program. It lives in the Session's arena, along with everything allocated while compiling it.
+class SessionProgram {
+public:
+  std::vector<SessionFile> files;
+  ScopeNode* root = 0;
+  std::vector<Node*> instructions; //Validated and optimized
+  std::vector<VariableReferenceNode*> references; //References to functions made by top-level code
+  std::vector<FunctionNode*> evaluated; //Functions evaluated at compile time while optimizing top-level code
+  bool valid = false;
+};
+
+static bool read_source(const std::string& filename, std::string& source) {
+  FILE* file = fopen(filename.data(),"rb");
+  if(!file) {
+    return false;
+  }
+  char buffer[4096];
+  size_t len;
+  while((len = fread(buffer,1,sizeof(buffer),file))) {
+    source.append(buffer,len);
+  }
+  fclose(file);
+  return true;
+}
+
+//Parses a version of a file, and fingerprints its declarations
+static bool parse_file(const char* filename, const std::string& code, SessionFile& file) {
+  file.source.filename = filename;
+  file.source.code = (char*)current_arena->allocate(code.size()+1);
+  memcpy(file.source.code,code.data(),code.size()+1);
+  file.size = code.size();
+  if(!parse_source(file.source)) {
+    report(0,"%s: Unexpected end of file",filename);
+    return false;
+  }
+  Fingerprint declarations;
+  std::vector<Node*>& nodes = *file.source.instructions;
+  for(size_t i = 0;i<nodes.size();i++) {
+    if(nodes[i]->type == Function && !((FunctionNode*)nodes[i])->isExtern) {
+      Fingerprint body;
+      body.node(nodes[i]);
+      file.functions.push_back((FunctionNode*)nodes[i]);
+      file.fingerprints.push_back(sha256(body.data));
+      declarations.write(Function);
+      declarations.signature((FunctionNode*)nodes[i]);
+    }else {
+      declarations.node(nodes[i]);
+    }
+  }
+  //Aliases are only named by the scope
+  for(auto token = file.source.scope->tokens.begin();token != file.source.scope->tokens.end();token++) {
+    declarations.write(token->first);
+    declarations.write(token->second->type);
+  }
+  file.declarations = sha256(declarations.data);
+  return true;
+}
+
+//Every function defined in a block (including nested functions and class methods)
+static void collect_functions(Node** nodes, size_t count, std::vector<FunctionNode*>& functions) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case Function:
+      {
+	FunctionNode* func = (FunctionNode*)nodes[i];
+	functions.push_back(func);
+	collect_functions(func->operations.data(),func->operations.size(),functions);
+      }
+	break;
+      case Class:
+      {
+	ClassNode* cls = (ClassNode*)nodes[i];
+	collect_functions(cls->instructions.data(),cls->instructions.size(),functions);
+	if(cls->init) {
+	  functions.push_back(cls->init);
+	}
+      }
+	break;
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	collect_functions(node->instructions_true.data(),node->instructions_true.size(),functions);
+	collect_functions(node->instructions_false.data(),node->instructions_false.size(),functions);
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	if(node->initializer) {
+	  collect_functions(&node->initializer,1,functions);
+	}
+	collect_functions(node->body.data(),node->body.size(),functions);
+      }
+	break;
+    }
+  }
+}
+
+Session::Session() {
+  arena = new Arena();
+}
+
+Session::~Session() {
+  delete arena;
+}
+
+bool Session::loadPrelude(const char* filename) {
+  preludeData = map_prelude(filename,&preludeSize);
+  prelude = preludeData ? filename : 0;
+  return preludeData;
+}
+
+void Session::addFile(const char* filename) {
+  filenames.push_back(filename);
+}
+
+SessionProgram* Session::rebuild(std::vector<std::string>& sources, const CompilerOptions& programOptions) {
+  SessionProgram* program = current_arena->own(new SessionProgram());
+  program->files.resize(filenames.size());
+  std::vector<SourceFile> files;
+  for(size_t i = 0;i<filenames.size();i++) {
+    if(!parse_file(filenames[i].data(),sources[i],program->files[i])) {
+      return program;
+    }
+    files.push_back(program->files[i].source);
+    validated+=program->files[i].functions.size();
+  }
+  program->root = compile_program(files,prelude,preludeData,preludeSize,programOptions,program->instructions,&program->references);
+  if(!program->root) {
+    return program;
+  }
+  optimize(program->instructions,programOptions,&program->evaluated);
+  program->valid = true;
+  return program;
+}
+
+int Session::update(std::vector<std::string>& sources, const CompilerOptions& programOptions) {
+  std::vector<SessionFile*> parsed(filenames.size(),(SessionFile*)0); //New versions of files
+  std::map<FunctionNode*,FunctionNode*> replaced; //Current version of each changed function, and its new version
+  std::map<FunctionNode*,std::pair<size_t,size_t> > location; //File and index of each top-level function
+  for(size_t i = 0;i<filenames.size();i++) {
+    SessionFile& file = program->files[i];
+    for(size_t c = 0;c<file.functions.size();c++) {
+      location[file.functions[c]] = std::make_pair(i,c);
+    }
+    if(sources[i].size() == file.size && memcmp(sources[i].data(),file.source.code,file.size) == 0) {
+      continue;
+    }
+    SessionFile* next = current_arena->own(new SessionFile());
+    if(!parse_file(filenames[i].data(),sources[i],*next) || next->declarations != file.declarations) {
+      return UpdateRebuild;
+    }
+    parsed[i] = next;
+    for(size_t c = 0;c<file.functions.size();c++) {
+      if(next->fingerprints[c] != file.fingerprints[c]) {
+	replaced[file.functions[c]] = next->functions[c];
+      }
+    }
+  }
+  //Dependency graph. Code refers to the functions it calls (or uses as values), and its optimized form also depends on the bodies
+  //of the functions that were evaluated at compile time. Edges are kept for each top-level function; the rest of the program is global.
+  std::map<FunctionNode*,std::set<FunctionNode*> > callers; //Top-level functions that refer to each function
+  std::map<FunctionNode*,std::set<FunctionNode*> > dependents; //Top-level functions that evaluated each function
+  std::set<FunctionNode*> owned; //Top-level functions and the functions nested in them
+  for(auto owner = location.begin();owner != location.end();owner++) {
+    std::vector<FunctionNode*> nested;
+    collect_functions((Node**)&owner->first,1,nested);
+    for(size_t i = 0;i<nested.size();i++) {
+      owned.insert(nested[i]);
+      for(size_t c = 0;c<nested[i]->references.size();c++) {
+	callers[nested[i]->references[c]->function].insert(owner->first);
+      }
+      for(size_t c = 0;c<nested[i]->evaluated.size();c++) {
+	dependents[nested[i]->evaluated[c]].insert(owner->first);
+      }
+    }
+  }
+  std::vector<VariableReferenceNode*> references = program->references; //References made by global code
+  std::set<FunctionNode*> evaluated(program->evaluated.begin(),program->evaluated.end()); //Functions evaluated by global code
+  std::vector<FunctionNode*> functions;
+  collect_functions(program->instructions.data(),program->instructions.size(),functions);
+  for(size_t i = 0;i<functions.size();i++) {
+    if(owned.find(functions[i]) == owned.end()) {
+      references.insert(references.end(),functions[i]->references.begin(),functions[i]->references.end());
+      evaluated.insert(functions[i]->evaluated.begin(),functions[i]->evaluated.end());
+    }
+  }
+  //Code that evaluated a changed function is recompiled with it
+  std::vector<FunctionNode*> changed;
+  for(auto func = replaced.begin();func != replaced.end();func++) {
+    changed.push_back(func->first);
+  }
+  for(size_t i = 0;i<changed.size();i++) {
+    if(evaluated.find(changed[i]) != evaluated.end()) {
+      return UpdateRebuild;
+    }
+    std::set<FunctionNode*>& users = dependents[changed[i]];
+    for(auto user = users.begin();user != users.end();user++) {
+      if(replaced.find(*user) != replaced.end()) {
+	continue;
+      }
+      std::pair<size_t,size_t> pos = location[*user];
+      if(!parsed[pos.first]) {
+	parsed[pos.first] = current_arena->own(new SessionFile());
+	if(!parse_file(filenames[pos.first].data(),sources[pos.first],*parsed[pos.first])) {
+	  return UpdateRebuild;
+	}
+      }
+      replaced[*user] = parsed[pos.first]->functions[pos.second];
+    }
+  }
+  //The new versions of functions resolve names through the program's global scope
+  for(size_t i = 0;i<parsed.size();i++) {
+    if(parsed[i]) {
+      ScopeNode* scope = parsed[i]->source.scope;
+      scope->tokens.clear();
+      scope->parent = program->root;
+      scope->mangled_name = program->root->mangle();
+    }
+  }
+  for(auto func = replaced.begin();func != replaced.end();func++) {
+    FunctionNode* current = func->first;
+    FunctionNode* next = func->second;
+    Node*& head = program->root->tokens.find(current->name)->second;
+    if(head == current) {
+      head = next;
+    }else {
+      FunctionNode* prev = (FunctionNode*)head;
+      while(prev->nextOverload != current) {
+	prev = prev->nextOverload;
+      }
+      prev->nextOverload = next;
+    }
+    next->nextOverload = current->nextOverload;
+    for(size_t i = 0;i<program->instructions.size();i++) {
+      if(program->instructions[i] == current) {
+	program->instructions[i] = next;
+	break;
+      }
+    }
+    std::pair<size_t,size_t> pos = location[current];
+    program->files[pos.first].functions[pos.second] = next;
+    program->files[pos.first].fingerprints[pos.second] = parsed[pos.first]->fingerprints[pos.second];
+  }
+  //Unchanged code is pointed at the new versions of the functions it refers to
+  for(auto func = replaced.begin();func != replaced.end();func++) {
+    std::set<FunctionNode*>& users = callers[func->first];
+    for(auto user = users.begin();user != users.end();user++) {
+      if(replaced.find(*user) != replaced.end()) {
+	continue;
+      }
+      std::vector<FunctionNode*> nested;
+      collect_functions((Node**)&*user,1,nested);
+      for(size_t i = 0;i<nested.size();i++) {
+	for(size_t c = 0;c<nested[i]->references.size();c++) {
+	  VariableReferenceNode* reference = nested[i]->references[c];
+	  if(reference->function == func->first) {
+	    reference->function = func->second;
+	  }
+	}
+      }
+    }
+  }
+  for(size_t i = 0;i<references.size();i++) {
+    auto func = replaced.find(references[i]->function);
+    if(func != replaced.end()) {
+      references[i]->function = func->second;
+    }
+  }
+  for(size_t i = 0;i<parsed.size();i++) {
+    if(parsed[i]) {
+      program->files[i].source.code = parsed[i]->source.code;
+      program->files[i].size = parsed[i]->size;
+    }
+  }
+  bool rval = true;
+  for(auto func = replaced.begin();func != replaced.end();func++) {
+    rval &= validate_function(func->second,program->root);
+    validated++;
+  }
+  if(!rval) {
+    report(0,"Compilation failed due to validation errors.");
+    program->valid = false;
+    return UpdateFailed;
+  }
+  for(auto func = replaced.begin();func != replaced.end();func++) {
+    optimize(func->second,programOptions);
+  }
+  return UpdateDone;
+}
+
+bool Session::compile(std::vector<unsigned char>& image) {
+  errors.clear();
+  image.clear();
+  validated = 0;
+  rebuilt = false;
+  std::vector<std::string> sources(filenames.size());
+  for(size_t i = 0;i<filenames.size();i++) {
+    if(!read_source(filenames[i],sources[i])) {
+      ValidationError error;
+      error.msg = filenames[i]+": Unable to read file";
+      errors.push_back(error);
+      return false;
+    }
+  }
+  CompilerOptions programOptions = options;
+  programOptions.jobs = 1; //Memory allocated from the arena can't be released on other threads
+  programOptions.units = &units;
+  Arena* outerArena = current_arena;
+  std::vector<ValidationError>* outerErrors = diagnostics;
+  current_arena = arena;
+  arena->active = true;
+  std::vector<ValidationError> found;
+  diagnostics = &found;
+  int status = UpdateRebuild;
+  //Garbage from updates (such as the unchanged parts of reparsed files and code generation) is released by the next rebuild
+  if(program && program->valid && arena->size() < baseline*8) {
+    status = update(sources,programOptions);
+  }
+  if(status == UpdateRebuild) {
+    arena->active = false;
+    delete arena;
+    arena = new Arena();
+    current_arena = arena;
+    arena->active = true;
+    found.clear(); //Errors of the update refer to its nodes
+    validated = 0;
+    rebuilt = true;
+    program = rebuild(sources,programOptions);
+  }
+  unsigned char* code = 0;
+  size_t len;
+  if(program->valid) {
+    code = gencode(program->instructions.data(),program->instructions.size(),program->root,&len,programOptions);
+  }
+  if(rebuilt) {
+    baseline = arena->size();
+  }
+  arena->active = false;
+  diagnostics = outerErrors;
+  current_arena = outerArena;
+  errors.swap(found);
+  units.prune();
+  if(!code) {
+    return false;
+  }
+  image.assign(code,code+len);
+  free(code);
+  return true;
+}
@@ -0,0 +1,199 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Compilation statistics (--time-report and --stats)
+
+#include "stats.h"
+#include "tree.h"
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+CompilerStats* compiler_stats = 0;
+thread_local size_t pending_node_bytes = 0;
+
+static const char* node_names[] = {"Class","Scope","VariableDeclaration","AssignOp","Constant","BinaryExpression","VariableReference","Goto","Label","UnaryExpression","Function","Alias","FunctionCall","IfStatement","WhileStatement","ReturnStatement","Nop"};
+static_assert(sizeof(node_names)/sizeof(*node_names) == Nop+1,"Every NodeType needs a name");
+static_assert(Nop < 32,"CompilerStats::nodes is too small");
+
+void stats_clock(double* times) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  times[0] = ts.tv_sec+ts.tv_nsec/1e9;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&ts);
+  times[1] = ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+void stats_reset_peak() {
+  //Resets VmHWM (Linux 4.0 and later)
+  int fd = open("/proc/self/clear_refs",O_WRONLY);
+  if(fd>=0) {
+    write(fd,"5",1);
+    close(fd);
+  }
+}
+
+size_t stats_peak() {
+  FILE* file = fopen("/proc/self/status","rb");
+  if(!file) {
+    return 0;
+  }
+  char line[256];
+  size_t rval = 0;
+  while(fgets(line,sizeof(line),file)) {
+    if(strncmp(line,"VmHWM:",6) == 0) {
+      rval = strtoull(line+6,0,10);
+      break;
+    }
+  }
+  fclose(file);
+  return rval;
+}
+
+CompilerStats::CompilerStats():lookups(0),lookupDepth(0),maxLookupDepth(0),overloadResolutions(0),overloadCandidates(0),typeInfos(0),heapAllocations(0),heapBytes(0),symbolTables(0),symbolTableBytes(0),mangledNames(0),mangledBytes(0),codeBuffers(0),codeBytes(0) {
+  for(size_t i = 0;i<32;i++) {
+    nodes[i] = 0;
+    nodeAllocations[i] = 0;
+    nodeBytes[i] = 0;
+  }
+  stats_clock(start);
+}
+
+void CompilerStats::addPhase(const char* name, double wall, double cpu, size_t peakRSS) {
+  std::lock_guard<std::mutex> l(mtx);
+  size_t i = 0;
+  while(i<phases.size() && strcmp(phases[i].name,name)) {
+    i++;
+  }
+  if(i == phases.size()) {
+    PhaseTime phase;
+    phase.name = name;
+    phases.push_back(phase);
+  }
+  phases[i].wall+=wall;
+  phases[i].cpu+=cpu;
+  if(peakRSS > phases[i].peakRSS) {
+    phases[i].peakRSS = peakRSS;
+  }
+}
+
+void CompilerStats::addEmitted(const std::string& name, size_t bytes) {
+  std::lock_guard<std::mutex> l(mtx);
+  EmittedUnit unit;
+  unit.name = name;
+  unit.bytes = bytes;
+  emitted.push_back(unit);
+}
+
+void CompilerStats::print(FILE* out, bool counters) {
+  double now[2];
+  stats_clock(now);
+  fprintf(out,"%-12s %10s %10s\n","Phase","Wall (s)","CPU (s)");
+  for(size_t i = 0;i<phases.size();i++) {
+    fprintf(out,"%-12s %10.4f %10.4f\n",phases[i].name,phases[i].wall,phases[i].cpu);
+  }
+  fprintf(out,"%-12s %10.4f %10.4f\n","total",now[0]-start[0],now[1]-start[1]);
+  if(!counters) {
+    return;
+  }
+  fprintf(out,"\nNodes created:\n");
+  for(size_t i = 0;i<=Nop;i++) {
+    if(nodes[i]) {
+      fprintf(out,"  %-20s %10llu\n",node_names[i],(unsigned long long)nodes[i]);
+    }
+  }
+  fprintf(out,"Scope lookups: %llu (average depth %.2f, maximum %llu)\n",(unsigned long long)lookups,lookups ? (double)lookupDepth/lookups : 0.0,(unsigned long long)maxLookupDepth);
+  fprintf(out,"Overload resolutions: %llu (%llu candidates tried)\n",(unsigned long long)overloadResolutions,(unsigned long long)overloadCandidates);
+  fprintf(out,"TypeInfo allocations: %llu\n",(unsigned long long)typeInfos);
+  size_t total = 0;
+  for(size_t i = 0;i<emitted.size();i++) {
+    total+=emitted[i].bytes;
+  }
+  fprintf(out,"Emitted code: %zu bytes in %zu units\n",total,emitted.size());
+  std::vector<EmittedUnit> largest = emitted;
+  std::stable_sort(largest.begin(),largest.end(),[](const EmittedUnit& a, const EmittedUnit& b) {
+    return a.bytes > b.bytes;
+  });
+  for(size_t i = 0;i<largest.size() && i<10;i++) {
+    fprintf(out,"  %10zu %s\n",largest[i].bytes,largest[i].name.data());
+  }
+}
+
+void CompilerStats::printMemory(FILE* out) {
+  fprintf(out,"%-12s %14s\n","Phase","Peak RSS (KB)");
+  for(size_t i = 0;i<phases.size();i++) {
+    fprintf(out,"%-12s %14zu\n",phases[i].name,phases[i].peakRSS);
+  }
+  fprintf(out,"\nAllocated with new: %llu bytes in %llu allocations\n",(unsigned long long)heapBytes,(unsigned long long)heapAllocations);
+  fprintf(out,"%-22s %10s %12s\n","Nodes allocated","Count","Bytes");
+  for(size_t i = 0;i<=Nop;i++) {
+    if(nodeAllocations[i]) {
+      fprintf(out,"  %-20s %10llu %12llu\n",node_names[i],(unsigned long long)nodeAllocations[i],(unsigned long long)nodeBytes[i]);
+    }
+  }
+  fprintf(out,"%-22s %10llu %12llu\n","Symbol tables",(unsigned long long)symbolTables,(unsigned long long)symbolTableBytes);
+  fprintf(out,"%-22s %10llu %12llu\n","Mangled names",(unsigned long long)mangledNames,(unsigned long long)mangledBytes);
+  fprintf(out,"%-22s %10llu %12llu\n","Code buffers",(unsigned long long)codeBuffers,(unsigned long long)codeBytes);
+}
+
+static void print_string(FILE* out, const std::string& value) {
+  fputc('"',out);
+  for(size_t i = 0;i<value.size();i++) {
+    unsigned char c = value[i];
+    if(c == '"' || c == '\\') {
+      fprintf(out,"\\%c",c);
+    }else if(c < 0x20) {
+      fprintf(out,"\\u%04x",c);
+    }else {
+      fputc(c,out);
+    }
+  }
+  fputc('"',out);
+}
+
+void CompilerStats::printJSON(FILE* out) {
+  double now[2];
+  stats_clock(now);
+  fprintf(out,"{\"phases\":[");
+  for(size_t i = 0;i<phases.size();i++) {
+    fprintf(out,"%s{\"name\":\"%s\",\"wall\":%.6f,\"cpu\":%.6f",i ? "," : "",phases[i].name,phases[i].wall,phases[i].cpu);
+    if(memory) {
+      fprintf(out,",\"peakRSS\":%zu",phases[i].peakRSS);
+    }
+    fprintf(out,"}");
+  }
+  fprintf(out,"],\"total\":{\"wall\":%.6f,\"cpu\":%.6f},\"nodes\":{",now[0]-start[0],now[1]-start[1]);
+  for(size_t i = 0;i<=Nop;i++) {
+    fprintf(out,"%s\"%s\":%llu",i ? "," : "",node_names[i],(unsigned long long)nodes[i]);
+  }
+  fprintf(out,"},\"lookups\":{\"count\":%llu,\"depth\":%llu,\"maxDepth\":%llu}",(unsigned long long)lookups,(unsigned long long)lookupDepth,(unsigned long long)maxLookupDepth);
+  fprintf(out,",\"overloads\":{\"resolutions\":%llu,\"candidates\":%llu}",(unsigned long long)overloadResolutions,(unsigned long long)overloadCandidates);
+  fprintf(out,",\"typeInfos\":%llu,\"emitted\":[",(unsigned long long)typeInfos);
+  for(size_t i = 0;i<emitted.size();i++) {
+    fprintf(out,"%s{\"name\":",i ? "," : "");
+    print_string(out,emitted[i].name);
+    fprintf(out,",\"bytes\":%zu}",emitted[i].bytes);
+  }
+  fprintf(out,"]");
+  if(memory) {
+    fprintf(out,",\"memory\":{\"heap\":{\"count\":%llu,\"bytes\":%llu},\"nodes\":{",(unsigned long long)heapAllocations,(unsigned long long)heapBytes);
+    for(size_t i = 0;i<=Nop;i++) {
+      fprintf(out,"%s\"%s\":{\"count\":%llu,\"bytes\":%llu}",i ? "," : "",node_names[i],(unsigned long long)nodeAllocations[i],(unsigned long long)nodeBytes[i]);
+    }
+    fprintf(out,"},\"symbolTables\":{\"count\":%llu,\"bytes\":%llu}",(unsigned long long)symbolTables,(unsigned long long)symbolTableBytes);
+    fprintf(out,",\"mangledNames\":{\"count\":%llu,\"bytes\":%llu}",(unsigned long long)mangledNames,(unsigned long long)mangledBytes);
+    fprintf(out,",\"codeBuffers\":{\"count\":%llu,\"bytes\":%llu}}",(unsigned long long)codeBuffers,(unsigned long long)codeBytes);
+  }
+  fprintf(out,"}\n");
+}
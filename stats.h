@@ -0,0 +1,111 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#ifndef STATS_HEADER
+#define STATS_HEADER
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+
+//Time spent in a phase of compilation, in seconds
+class PhaseTime {
+public:
+  const char* name;
+  double wall = 0;
+  double cpu = 0; //CPU time of the whole process (including worker threads)
+  size_t peakRSS = 0; //Highest resident set size during the phase, in KB (only collected for --mem-report)
+};
+
+//Code generated for a function (or for top-level code or a class initializer)
+class EmittedUnit {
+public:
+  std::string name;
+  size_t bytes;
+};
+
+//Phase timings and counters collected while compiling (see --time-report, --stats and --mem-report).
+//Statistics are collected by the whole process while compiler_stats is set.
+class CompilerStats {
+public:
+  bool memory = false; //Collect memory statistics and per-phase peak RSS
+  std::atomic<uint64_t> nodes[32]; //Nodes created, by NodeType
+  std::atomic<uint64_t> lookups; //Names resolved through a scope and its parents
+  std::atomic<uint64_t> lookupDepth; //Scopes searched by all lookups
+  std::atomic<uint64_t> maxLookupDepth;
+  std::atomic<uint64_t> overloadResolutions; //Calls resolved to an overload
+  std::atomic<uint64_t> overloadCandidates; //Overloads tried by all resolutions
+  std::atomic<uint64_t> typeInfos; //TypeInfo descriptors allocated
+  //Memory statistics (bytes allocated, whether or not they were freed again)
+  std::atomic<uint64_t> heapAllocations;
+  std::atomic<uint64_t> heapBytes; //Everything allocated with operator new
+  std::atomic<uint64_t> nodeAllocations[32]; //Nodes allocated with new (rather than embedded in another node), by NodeType
+  std::atomic<uint64_t> nodeBytes[32];
+  std::atomic<uint64_t> symbolTables; //Scopes with at least one name
+  std::atomic<uint64_t> symbolTableBytes; //Entry and index arrays of symbol tables
+  std::atomic<uint64_t> mangledNames;
+  std::atomic<uint64_t> mangledBytes;
+  std::atomic<uint64_t> codeBuffers; //Assembly buffers of code units and images
+  std::atomic<uint64_t> codeBytes;
+  std::vector<PhaseTime> phases; //In order of first use
+  std::vector<EmittedUnit> emitted;
+  double start[2]; //Wall and CPU time when collection started
+  std::mutex mtx;
+  CompilerStats();
+  void lookup(uint64_t depth) {
+    lookups++;
+    lookupDepth+=depth;
+    uint64_t max = maxLookupDepth;
+    while(depth > max && !maxLookupDepth.compare_exchange_weak(max,depth)) {
+    }
+  }
+  void addPhase(const char* name, double wall, double cpu, size_t peakRSS);
+  void addEmitted(const std::string& name, size_t bytes);
+  void print(FILE* out, bool counters);
+  void printMemory(FILE* out);
+  void printJSON(FILE* out);
+};
+
+extern CompilerStats* compiler_stats; //Statistics being collected (or 0)
+extern thread_local size_t pending_node_bytes; //Size of the node being constructed on this thread (see Node::operator new)
+
+//Wall and CPU time
+void stats_clock(double* times);
+//Starts a new peak resident set size measurement (where the kernel supports it)
+void stats_reset_peak();
+//Peak resident set size (in KB) since the last reset
+size_t stats_peak();
+
+//Adds the time spent until the end of the scope to a phase (if statistics are being collected)
+class PhaseTimer {
+public:
+  const char* name;
+  double start[2];
+  PhaseTimer(const char* name):name(name) {
+    if(compiler_stats) {
+      if(compiler_stats->memory) {
+	stats_reset_peak();
+      }
+      stats_clock(start);
+    }
+  }
+  ~PhaseTimer() {
+    if(compiler_stats) {
+      double end[2];
+      stats_clock(end);
+      compiler_stats->addPhase(name,end[0]-start[0],end[1]-start[1],compiler_stats->memory ? stats_peak() : 0);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Streaming compilation (--stream)
+//The files are first parsed without the bodies of their top-level functions, so that every declaration is known
+//before any function is compiled. Then each function is parsed, validated, optimized and compiled to the in-memory
+//cache in turn, after which its tree is deleted. Peak memory is proportional to the declarations and the largest
+//function, rather than the whole program. Functions that can't be compiled on their own (see gencode_function)
+//keep their tree, and are compiled with the top-level code.
+
+#include "tree.h"
+#include "vpp.h"
+#include <set>
+#include <vector>
+
+bool gencode_function(FunctionNode* function, const CompilerOptions& options);
+void optimize(FunctionNode* function, const CompilerOptions& options);
+
+//Collects the nodes owned by a statement or expression (nodes can be shared, such as operands of operator calls)
+static void collect_nodes(Node* node, std::set<Node*>& nodes) {
+  if(!node || !nodes.insert(node).second) {
+    return;
+  }
+  switch(node->type) {
+    case VariableDeclaration:
+      collect_nodes(((VariableDeclarationNode*)node)->assignment,nodes);
+      break;
+    case BinaryExpression:
+    {
+      BinaryExpressionNode* bexp = (BinaryExpressionNode*)node;
+      collect_nodes(bexp->lhs,nodes);
+      collect_nodes(bexp->rhs,nodes);
+      collect_nodes(bexp->function,nodes);
+    }
+      break;
+    case UnaryExpression:
+    {
+      UnaryNode* unode = (UnaryNode*)node;
+      collect_nodes(unode->operand,nodes);
+      collect_nodes(unode->function,nodes);
+    }
+      break;
+    case FunctionCall:
+    {
+      FunctionCallNode* call = (FunctionCallNode*)node;
+      collect_nodes(call->function,nodes);
+      for(size_t i = 0;i<call->args.size();i++) {
+	collect_nodes(call->args[i],nodes);
+      }
+    }
+      break;
+    case IfStatement:
+    {
+      IfStatementNode* statement = (IfStatementNode*)node;
+      collect_nodes(statement->condition,nodes);
+      for(size_t i = 0;i<statement->instructions_true.size();i++) {
+	collect_nodes(statement->instructions_true[i],nodes);
+      }
+      for(size_t i = 0;i<statement->instructions_false.size();i++) {
+	collect_nodes(statement->instructions_false[i],nodes);
+      }
+    }
+      break;
+    case WhileStatement:
+    {
+      WhileStatementNode* statement = (WhileStatementNode*)node;
+      collect_nodes(statement->condition,nodes);
+      collect_nodes(statement->initializer,nodes);
+      for(size_t i = 0;i<statement->body.size();i++) {
+	collect_nodes(statement->body[i],nodes);
+      }
+    }
+      break;
+    case ReturnStatement:
+      collect_nodes(((ReturnStatementNode*)node)->retval,nodes);
+      break;
+  }
+}
+
+static void delete_node(Node* node) {
+  switch(node->type) {
+    case VariableDeclaration:
+      delete (VariableDeclarationNode*)node;
+      break;
+    case Constant:
+      delete (ConstantNode*)node;
+      break;
+    case BinaryExpression:
+      delete (BinaryExpressionNode*)node;
+      break;
+    case UnaryExpression:
+      delete (UnaryNode*)node;
+      break;
+    case VariableReference:
+      delete (VariableReferenceNode*)node;
+      break;
+    case FunctionCall:
+      delete (FunctionCallNode*)node;
+      break;
+    case IfStatement:
+      delete (IfStatementNode*)node;
+      break;
+    case WhileStatement:
+      delete (WhileStatementNode*)node;
+      break;
+    case ReturnStatement:
+      delete (ReturnStatementNode*)node;
+      break;
+    case Goto:
+      delete (GotoNode*)node;
+      break;
+    case Label:
+      delete (LabelNode*)node;
+      break;
+    case Nop:
+      delete (Nope*)node;
+      break;
+  }
+}
+
+//Returns true if a block declares functions or classes (which are compiled separately, and may be referred to from elsewhere)
+static bool has_declarations(Node** nodes, size_t count) {
+  for(size_t i = 0;i<count;i++) {
+    switch(nodes[i]->type) {
+      case Function:
+      case Class:
+	return true;
+      case IfStatement:
+      {
+	IfStatementNode* node = (IfStatementNode*)nodes[i];
+	if(has_declarations(node->instructions_true.data(),node->instructions_true.size()) || has_declarations(node->instructions_false.data(),node->instructions_false.size())) {
+	  return true;
+	}
+      }
+	break;
+      case WhileStatement:
+      {
+	WhileStatementNode* node = (WhileStatementNode*)nodes[i];
+	if((node->initializer && has_declarations(&node->initializer,1)) || has_declarations(node->body.data(),node->body.size())) {
+	  return true;
+	}
+      }
+	break;
+    }
+  }
+  return false;
+}
+
+//Deletes the body of a function whose code has been generated. Its signature stays in the tree.
+static void release_body(FunctionNode* function) {
+  std::set<Node*> nodes;
+  for(size_t i = 0;i<function->operations.size();i++) {
+    collect_nodes(function->operations[i],nodes);
+  }
+  for(size_t i = 0;i<function->vars.size();i++) {
+    collect_nodes(function->vars[i],nodes);
+  }
+  for(auto node = nodes.begin();node != nodes.end();node++) {
+    delete_node(*node);
+  }
+  std::vector<Node*>().swap(function->operations);
+  std::vector<VariableDeclarationNode*>().swap(function->vars);
+  std::vector<VariableReferenceNode*>().swap(function->references);
+  std::vector<FunctionNode*>().swap(function->evaluated);
+  function->scope.tokens.clear();
+  for(size_t i = 0;i<function->args.size();i++) {
+    function->scope.add(function->args[i]->name,function->args[i]);
+  }
+}
+
+unsigned char* compile_stream(std::vector<SourceFile>& files, const char* prelude, const unsigned char* preludeData, size_t preludeSize, size_t* size, const CompilerOptions& options) {
+  for(size_t i = 0;i<files.size();i++) {
+    files[i].skipBodies = true;
+  }
+  if(!parse_files(files,options.jobs)) {
+    return 0;
+  }
+  std::vector<Node*> instructions;
+  ScopeNode* root = compile_program(files,prelude,preludeData,preludeSize,options,instructions);
+  if(!root) {
+    return 0;
+  }
+  UnitCache units;
+  CompilerOptions streamOptions = options;
+  streamOptions.units = &units;
+  bool rval = true;
+  for(size_t i = 0;i<files.size();i++) {
+    std::vector<Node*>& nodes = *files[i].instructions;
+    for(size_t c = 0;c<nodes.size();c++) {
+      FunctionNode* function = (FunctionNode*)nodes[c];
+      if(function->type != Function || !function->source) {
+	continue;
+      }
+      if(!parse_body(files[i],function) || !validate_function(function,root)) {
+	rval = false;
+	continue;
+      }
+      if(!rval) {
+	continue; //Only looking for more errors
+      }
+      optimize(function,streamOptions);
+      if(!has_declarations(function->operations.data(),function->operations.size()) && gencode_function(function,streamOptions)) {
+	release_body(function);
+      }
+    }
+  }
+  if(!rval) {
+    report(0,"Compilation failed due to validation errors.");
+    return 0;
+  }
+  return compile_image(instructions,root,size,streamOptions);
+}
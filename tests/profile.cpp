@@ -0,0 +1,116 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Profile round trip test: compiles an instrumented program, fills the counters of its profile area as a run
+//would, saves the area with the profile runtime and reads it back with read_profile.
+//
+//Usage: profile program scratch-file
+
+#include "vpp.h"
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+static int fail(const char* msg) {
+  printf("FAILED: %s\n",msg);
+  return 1;
+}
+
+int main(int argc, char** argv) {
+  if(argc != 3) {
+    printf("Usage: %s program scratch-file\n",argv[0]);
+    return 1;
+  }
+  std::ifstream file(argv[1]);
+  std::stringstream source;
+  source<<file.rdbuf();
+  std::string code = source.str();
+  Compiler compiler;
+  compiler.options.instrument = true;
+  compiler.options.dataSection = true;
+  std::vector<unsigned char> image;
+  if(!compiler.compile(argv[1],code.data(),code.size(),image)) {
+    for(size_t i = 0;i<compiler.errors.size();i++) {
+      printf("%s\n",compiler.errors[i].msg.data());
+    }
+    return fail("Compilation failed");
+  }
+  //The data section ends the image, followed by its size and "VDAT"
+  if(image.size()<12 || memcmp(image.data()+image.size()-4,"VDAT",4)) {
+    return fail("No data section");
+  }
+  uint64_t datalen;
+  memcpy(&datalen,image.data()+image.size()-12,sizeof(datalen));
+  if(datalen>image.size()-12) {
+    return fail("Invalid data section");
+  }
+  std::vector<uint64_t> data(datalen/8);
+  memcpy(data.data(),image.data()+image.size()-12-datalen,data.size()*8);
+  size_t start = 0;
+  while(start<data.size() && data[start] != PROFILE_MAGIC) {
+    start++;
+  }
+  if(start+3>data.size()) {
+    return fail("No profile area");
+  }
+  uint64_t* area = data.data()+start;
+  uint64_t units = area[1];
+  uint64_t total = area[2];
+  size_t header = 3;
+  for(uint64_t i = 0;i<units;i++) {
+    header+=3+(area[header+2]+7)/8;
+  }
+  if(start+header+total>data.size()) {
+    return fail("Truncated profile area");
+  }
+  //Give every counter a distinct count
+  for(uint64_t i = 0;i<total;i++) {
+    area[header+i] = i*3+1;
+  }
+  profile_output(argv[2]);
+  profile_write(area,(header+total)*sizeof(uint64_t));
+  Profile profile;
+  if(!read_profile(argv[2],profile)) {
+    return fail("Unable to read the profile back");
+  }
+  if(profile.units.size() != units) {
+    return fail("Wrong number of units");
+  }
+  header = 3;
+  for(uint64_t i = 0;i<units;i++) {
+    uint64_t first = area[header];
+    uint64_t count = area[header+1];
+    std::string name((const char*)(area+header+3),area[header+2]);
+    header+=3+(area[header+2]+7)/8;
+    auto unit = profile.units.find(name);
+    if(unit == profile.units.end() || unit->second.size() != count) {
+      return fail("Missing unit");
+    }
+    for(uint64_t c = 0;c<count;c++) {
+      if(unit->second[c] != (first+c)*3+1) {
+	return fail("Wrong count");
+      }
+    }
+  }
+  //A truncated profile is rejected
+  if(!profile_save(argv[2],area,(header+total-1)*sizeof(uint64_t))) {
+    return fail("Unable to write the profile");
+  }
+  Profile truncated;
+  if(read_profile(argv[2],truncated)) {
+    return fail("Truncated profile was accepted");
+  }
+  remove(argv[2]);
+  return 0;
+}
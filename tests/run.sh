@@ -0,0 +1,67 @@
+#!/bin/sh
+#Compiler tests
+#
+#Compiles a program at every optimization level, with and without --stream. Streaming must not change the image at
+#-O0. When an interpreter is given, the output of every image must match the output of the -O0 image, and if the
+#program has a .expected file next to it, the -O0 output must match it (compared value by value, ignoring whitespace).
+#Extra compiler flags for the program can be given in a .flags file next to it.
+#
+#Usage: run.sh vpp program [interpreter]
+
+VPP=$1
+SOURCE=$2
+UVM=$3
+EXPECTED=${SOURCE%.vlang}.expected
+FLAGS=
+if [ -f "${SOURCE%.vlang}.flags" ]; then
+  FLAGS=$(cat "${SOURCE%.vlang}.flags")
+fi
+if [ -z "$VPP" ] || [ -z "$SOURCE" ]; then
+  echo "Usage: $0 vpp program [interpreter]"
+  exit 1
+fi
+if [ -n "$UVM" ] && [ ! -x "$UVM" ]; then
+  echo "$UVM: Not an executable"
+  exit 1
+fi
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+failed=0
+for level in 0 1 2; do
+  for mode in "" --stream; do
+    image=$work/O$level$mode
+    if ! "$VPP" -O$level $mode $FLAGS -o "$image" "$SOURCE" > "$work/log" 2>&1; then
+      echo "FAILED: -O$level $mode: Compilation failed"
+      cat "$work/log"
+      failed=1
+      continue
+    fi
+    if [ -n "$UVM" ]; then
+      "$UVM" "$image" > "$image.out" 2>&1
+      if [ ! -f "$work/expected" ]; then
+	cp "$image.out" "$work/expected"
+	if [ -f "$EXPECTED" ]; then
+	  tr -s '[:space:]' '\n' < "$EXPECTED" > "$work/reference"
+	  tr -s '[:space:]' '\n' < "$image.out" > "$work/values"
+	  if ! cmp -s "$work/values" "$work/reference"; then
+	    echo "FAILED: -O$level $mode: Output differs from $EXPECTED"
+	    diff "$work/reference" "$work/values"
+	    failed=1
+	  fi
+	fi
+      elif ! cmp -s "$image.out" "$work/expected"; then
+	echo "FAILED: -O$level $mode: Output differs from -O0"
+	diff "$work/expected" "$image.out"
+	failed=1
+      fi
+    fi
+  done
+done
+if [ -f "$work/O0" ] && [ -f "$work/O0--stream" ] && ! cmp -s "$work/O0" "$work/O0--stream"; then
+  echo "FAILED: -O0 --stream: Image differs from -O0"
+  failed=1
+fi
+if [ -z "$UVM" ]; then
+  echo "Output not compared (no interpreter)"
+fi
+exit $failed
@@ -0,0 +1,100 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+static std::atomic<TraceBuffer*> buffers(0); //Buffers of all threads that have recorded events (never freed, as threads may exit before the trace is written)
+static thread_local TraceBuffer* buffer = 0; //Buffer of this thread
+static std::string exitFilename;
+
+static void trace_event(const char* name, bool enter) {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  if(!buffer) {
+    buffer = new TraceBuffer();
+    buffer->count = 0;
+    buffer->thread = syscall(SYS_gettid);
+    buffer->next = buffers.load(std::memory_order_relaxed);
+    while(!buffers.compare_exchange_weak(buffer->next,buffer,std::memory_order_release,std::memory_order_relaxed)) {
+    }
+  }
+  uint64_t count = buffer->count.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[count % TRACE_EVENTS];
+  event.time = (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+  event.name = name;
+  event.enter = enter;
+  buffer->count.store(count+1,std::memory_order_release);
+}
+
+void trace_enter(const char* name) {
+  trace_event(name,true);
+}
+
+void trace_exit(const char* name) {
+  trace_event(name,false);
+}
+
+//Writes a string as a JSON string literal
+static void write_string(FILE* out, const char* value) {
+  fputc('"',out);
+  for(const char* ptr = value;*ptr;ptr++) {
+    if(*ptr == '"' || *ptr == '\\') {
+      fputc('\\',out);
+      fputc(*ptr,out);
+    }else if((unsigned char)*ptr < 0x20) {
+      fprintf(out,"\\u%04x",*ptr);
+    }else {
+      fputc(*ptr,out);
+    }
+  }
+  fputc('"',out);
+}
+
+bool trace_write(const char* filename) {
+  FILE* out = fopen(filename,"wb");
+  if(!out) {
+    return false;
+  }
+  int pid = getpid();
+  bool first = true;
+  fprintf(out,"{\"traceEvents\":[");
+  for(TraceBuffer* i = buffers.load(std::memory_order_acquire);i;i = i->next) {
+    uint64_t count = i->count.load(std::memory_order_acquire);
+    for(uint64_t c = count > TRACE_EVENTS ? count-TRACE_EVENTS : 0;c<count;c++) {
+      const TraceEvent& event = i->events[c % TRACE_EVENTS];
+      fprintf(out,"%s\n{\"name\":",first ? "" : ",");
+      write_string(out,event.name);
+      fprintf(out,",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%llu}",event.enter ? 'B' : 'E',(unsigned long long)(event.time/1000),(unsigned)(event.time%1000),pid,(unsigned long long)i->thread);
+      first = false;
+    }
+  }
+  fprintf(out,"\n]}\n");
+  return !fclose(out);
+}
+
+static void write_at_exit() {
+  if(!trace_write(exitFilename.data())) {
+    fprintf(stderr,"%s: Unable to write trace\n",exitFilename.data());
+  }
+}
+
+void trace_write_at_exit(const char* filename) {
+  if(!exitFilename.size()) {
+    atexit(write_at_exit);
+  }
+  exitFilename = filename;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+//Function tracing runtime (--trace)
+
+#ifndef TRACE_HEADER
+#define TRACE_HEADER
+#include <atomic>
+#include <stdint.h>
+
+//An image compiled with --trace calls two externs around the body of every function (and of its top-level code
+//and class initializers):
+//  __vpp_trace_enter(name)
+//  __vpp_trace_exit(name)
+//where name points to the mangled name of the function in the image's data section. A host running traced images
+//binds them to trace_enter and trace_exit, which record timestamped events without taking locks, and writes the
+//events out as Chrome trace-event JSON (viewable in chrome://tracing or Perfetto) with trace_write.
+//Names are recorded by address, so the trace must be written while the image is still loaded.
+
+#define TRACE_EVENTS 65536 //Events kept per thread; once a thread's buffer is full, its oldest events are overwritten
+
+class TraceEvent {
+public:
+  uint64_t time; //Nanoseconds (CLOCK_MONOTONIC)
+  const char* name;
+  bool enter;
+};
+
+//Ring buffer of the events of one thread. Only the owning thread adds events.
+class TraceBuffer {
+public:
+  TraceEvent events[TRACE_EVENTS];
+  std::atomic<uint64_t> count; //Number of events recorded (the last TRACE_EVENTS of which are in events)
+  uint64_t thread;
+  TraceBuffer* next; //Buffer of another thread
+};
+
+void trace_enter(const char* name);
+void trace_exit(const char* name);
+//Writes the events recorded by every thread to filename, returning false if it can't be written.
+//Events recorded while the trace is being written may be missing or out of order.
+bool trace_write(const char* filename);
+//Writes the trace to filename when the process exits
+void trace_write_at_exit(const char* filename);
+
+#endif
@@ -12,26 +12,85 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #ifndef TREE_HEADER
 #define TREE_HEADER
 #include "libparse/parser.h"
+#include "stats.h"
+#include "arena.h"
 #include <map>
 #include <sstream>
 #include <vector>
+#include <atomic>
+#include <string.h>
+#include <stdint.h>
 
 
 using namespace libparse;
 
 
-enum NodeType {
+//Node kinds and constant types are stored in a byte so that the flags of a node pack around them
+enum NodeType : unsigned char {
   Class, Scope, VariableDeclaration, AssignOp, Constant, BinaryExpression, VariableReference, Goto, Label, UnaryExpression, Function, Alias, FunctionCall, IfStatement, WhileStatement, ReturnStatement, Nop
 };
-enum ConstantType {
+enum ConstantType : unsigned char {
   Integer, String, Character, Boolean
 };
+//Position of the parser running on this thread, which nodes record as they are constructed (see VParser)
+class SourceCursor {
+public:
+  const char* const* ptr; //Current position
+  const char* code; //Start of the file
+  uint32_t base; //Location of the start of the file
+};
+extern thread_local SourceCursor* source_cursor;
+//Destroys a node of any type, without releasing its memory (the finalizer of nodes allocated from an arena)
+void destroy_node(void* node);
+
 class Node {
 public:
-  bool validated = false;
+  //Where the node was parsed (0 if it wasn't). Locations number the bytes of all of a program's files in one range,
+  //starting at the SourceFile::base of each file.
+  uint32_t location = 0;
   NodeType type;
+  bool validated = false;
   Node(NodeType type):type(type) {
-    
+    if(source_cursor) {
+      location = source_cursor->base+(*source_cursor->ptr-source_cursor->code);
+    }
+    count();
+  }
+  //Copies made by the optimizer (see Cloner) are counted like parsed nodes
+  Node(const Node& other):location(other.location),type(other.type),validated(other.validated) {
+    count();
+  }
+  //Records the size of a node allocated with new, which its constructor attributes to its type (see --mem-report).
+  //Every constructor consumes the size, and nodes embedded in other nodes are constructed after the node containing them,
+  //so they aren't counted twice.
+  //While an arena is active on this thread, nodes are allocated from it, and destroyed when it is reset.
+  static void* operator new(size_t size) {
+    if(compiler_stats && compiler_stats->memory) {
+      pending_node_bytes = size;
+    }
+    if(current_arena && current_arena->active) {
+      void* rval = current_arena->allocate(size);
+      current_arena->finalize(destroy_node,rval);
+      return rval;
+    }
+    return ::operator new(size);
+  }
+  static void operator delete(void* ptr) {
+    if(current_arena && current_arena->release(ptr)) {
+      return; //Its memory is reclaimed when the arena is reset
+    }
+    ::operator delete(ptr);
+  }
+private:
+  void count() {
+    if(compiler_stats) {
+      compiler_stats->nodes[type]++;
+      if(pending_node_bytes) {
+	compiler_stats->nodeAllocations[type]++;
+	compiler_stats->nodeBytes[type]+=pending_node_bytes;
+	pending_node_bytes = 0;
+      }
+    }
   }
 };
 class Nope:public Node {
@@ -54,13 +113,105 @@ public:
   }
 };
 
+//Names declared in a scope, in order of declaration. Small tables are searched linearly;
+//larger ones are indexed by an open-addressed hash table of 32-bit entry numbers.
+class SymbolTable {
+public:
+  typedef std::pair<StringRef,Node*> Entry;
+  typedef Entry* iterator;
+  std::vector<Entry> entries;
+  std::vector<uint32_t> index; //Entry number+1 in each slot (0 if empty); empty while the table is small
+  static uint32_t hash(const StringRef& name) {
+    uint32_t rval = 2166136261u;
+    for(size_t i = 0;i<name.count;i++) {
+      rval = (rval ^ (unsigned char)name.ptr[i])*16777619u;
+    }
+    return rval;
+  }
+  static bool equals(const StringRef& a, const StringRef& b) {
+    return a.count == b.count && !memcmp(a.ptr,b.ptr,a.count);
+  }
+  iterator begin() {
+    return entries.data();
+  }
+  iterator end() {
+    return entries.data()+entries.size();
+  }
+  size_t size() {
+    return entries.size();
+  }
+  iterator find(const StringRef& name) {
+    if(!index.size()) {
+      for(size_t i = 0;i<entries.size();i++) {
+	if(equals(entries[i].first,name)) {
+	  return entries.data()+i;
+	}
+      }
+      return end();
+    }
+    size_t mask = index.size()-1;
+    for(size_t i = hash(name) & mask;index[i];i = (i+1) & mask) {
+      if(equals(entries[index[i]-1].first,name)) {
+	return entries.data()+index[i]-1;
+      }
+    }
+    return end();
+  }
+  //Adds a name which isn't in the table yet
+  void insert(const StringRef& name, Node* value) {
+    size_t capacity = entries.capacity();
+    entries.push_back(Entry(name,value));
+    if(compiler_stats && compiler_stats->memory && entries.capacity() != capacity) {
+      compiler_stats->symbolTables+=!capacity;
+      compiler_stats->symbolTableBytes+=entries.capacity()*sizeof(Entry);
+    }
+    if(entries.size()*2 > index.size()) {
+      if(entries.size() > 8) {
+	reindex();
+      }
+      return;
+    }
+    size_t mask = index.size()-1;
+    size_t i = hash(name) & mask;
+    while(index[i]) {
+      i = (i+1) & mask;
+    }
+    index[i] = entries.size();
+  }
+  void reindex() {
+    size_t capacity = 16;
+    while(capacity < entries.size()*4) {
+      capacity*=2;
+    }
+    index.assign(capacity,0);
+    if(compiler_stats && compiler_stats->memory) {
+      compiler_stats->symbolTableBytes+=capacity*sizeof(uint32_t);
+    }
+    for(size_t c = 0;c<entries.size();c++) {
+      size_t i = hash(entries[c].first) & (capacity-1);
+      while(index[i]) {
+	i = (i+1) & (capacity-1);
+      }
+      index[i] = c+1;
+    }
+  }
+  void clear() {
+    std::vector<Entry>().swap(entries);
+    std::vector<uint32_t>().swap(index);
+  }
+};
+
 class ScopeNode:public Node {
 public:
   ScopeNode* parent;
-  std::map<StringRef,Node*> tokens;
+  SymbolTable tokens;
   StringRef name; //Optional name of scope
   std::string mangled_name;
   void __mangle(std::stringstream& ss) {
+    if(mangled_name.size()) {
+      ss<<mangled_name;
+      return;
+    }
     if(parent) {
       parent->__mangle(ss);
     }
@@ -77,28 +228,38 @@ public:
     std::stringstream ss;
     __mangle(ss);
     mangled_name = ss.str();
+    if(compiler_stats && compiler_stats->memory) {
+      compiler_stats->mangledNames++;
+      compiler_stats->mangledBytes+=mangled_name.size();
+    }
     return mangled_name;
   }
   ScopeNode():Node(Scope) {
     parent = 0;
   }
   Node* resolve(const StringRef& name) {
-    if(tokens.find(name) == tokens.end()) {
-      if(parent) {
-	return parent->resolve(name);
+    size_t depth = 1;
+    for(ScopeNode* scope = this;scope;scope = scope->parent,depth++) {
+      SymbolTable::iterator token = scope->tokens.find(name);
+      if(token == scope->tokens.end()) {
+	continue;
       }
-      return 0;
-    }else {
-      Node* rval = tokens[name];
-      if(rval->type == Alias) {
-	return resolve(((AliasNode*)rval)->dest);
+      if(compiler_stats) {
+	compiler_stats->lookup(depth);
       }
-      return rval;
+      if(token->second->type == Alias) {
+	return scope->resolve(((AliasNode*)token->second)->dest);
+      }
+      return token->second;
     }
+    if(compiler_stats) {
+      compiler_stats->lookup(depth-1);
+    }
+    return 0;
   }
   bool add(const StringRef& name, Node* value) {
     if(tokens.find(name) == tokens.end()) {
-      tokens[name] = value;
+      tokens.insert(name,value);
       return true;
     }
     return false;
@@ -127,6 +288,7 @@ public:
 
 class FunctionNode;
 class VariableDeclarationNode;
+class TypeInfo;
 class ClassNode:public Node {
 public:
   ScopeNode scope;
@@ -136,9 +298,11 @@ public:
   std::map<VariableDeclarationNode*,VariableDeclarationNode*> lambdaRemapTable;
   int align; //Required memory alignment for class (or 0 if undefined)
   size_t size; //Required size for class (excluding padding) (or 0 if undefined)
-  ClassNode():Node(Class) {
+  std::atomic<TypeInfo*> types; //Interned type descriptors (see intern_type)
+  ClassNode():Node(Class),types(0) {
     
   }
+  ~ClassNode();
 };
 
 
@@ -147,9 +311,47 @@ class TypeInfo {
 public:
   int pointerLevels;
   ClassNode* type;
-  
+  TypeInfo* next = 0; //Next interned descriptor for the same class
 };
 
+inline ClassNode::~ClassNode() {
+  TypeInfo* i = types.load();
+  while(i) {
+    TypeInfo* next = i->next;
+    delete i;
+    i = next;
+  }
+}
+
+//Returns the shared descriptor for type with the given number of pointer levels.
+//Safe to call from multiple threads; descriptors are never modified after they are published.
+static inline TypeInfo* intern_type(ClassNode* type, int pointerLevels) {
+  TypeInfo* head = type->types.load(std::memory_order_acquire);
+  for(TypeInfo* i = head;i;i = i->next) {
+    if(i->pointerLevels == pointerLevels) {
+      return i;
+    }
+  }
+  TypeInfo* tinfo = new TypeInfo();
+  if(compiler_stats) {
+    compiler_stats->typeInfos++;
+  }
+  tinfo->type = type;
+  tinfo->pointerLevels = pointerLevels;
+  tinfo->next = head;
+  while(!type->types.compare_exchange_weak(tinfo->next,tinfo,std::memory_order_release,std::memory_order_acquire)) {
+    //Another thread published first; check whether it added the same descriptor.
+    for(TypeInfo* i = tinfo->next;i != head;i = i->next) {
+      if(i->pointerLevels == pointerLevels) {
+	delete tinfo;
+	return i;
+      }
+    }
+    head = tinfo->next;
+  }
+  return tinfo;
+}
+
 class Expression:public Node {
 public:
   bool isReference = false;
@@ -166,8 +368,9 @@ public:
 class ConstantNode:public Expression {
 public:
   ConstantType ctype;
-  StringRef value;
   int i32val;
+  StringRef value;
+  std::string strval; //Contents of a string literal (with escape sequences decoded)
 ConstantNode():Expression(Constant) {
 }
 
@@ -179,14 +382,15 @@ class VariableDeclarationNode:public Node {
 public:
   StringRef vartype;
   StringRef name;
-  BinaryExpressionNode* assignment = 0;
   bool isValidatingAssignment = false;
   bool skipValidateClassName = false;
-  ClassNode* rclass = 0;
+  bool isStatic = false; //True if this variable lives in the data section (reloffset is relative to the start of the data section)
+  bool isReference = false; //True if this is a reference to a memory location (pointer-like object) rather than a value itself.
   int pointerLevels = 0;
+  BinaryExpressionNode* assignment = 0;
+  ClassNode* rclass = 0;
   VariableDeclarationNode* lambdaRef = 0;
   size_t reloffset;
-  bool isReference = false; //True if this is a reference to a memory location (pointer-like object) rather than a value itself.
   FunctionNode* function = 0;
   VariableDeclarationNode():Node(VariableDeclaration) {
   }
@@ -236,6 +440,16 @@ public:
   std::vector<Node*> operations;
   ClassNode* thisType = 0; //Type of "this" pointer, if applicable (must be passed as last argument to function if nonzero).
   FunctionNode* nextOverload = 0;
+  bool isDeclared = false; //True once the signature (return and argument types) has been resolved
+  std::vector<VariableReferenceNode*> references; //References to functions (calls, operator methods and function values) made by the body
+  std::vector<FunctionNode*> evaluated; //Functions evaluated at compile time while optimizing the body
+  bool optimized = false; //True once the body has been optimized
+  int64_t executions = -1; //Number of calls in the execution profile (or -1 if the function isn't in the profile)
+  bool hot = false; //Called often according to the profile (see apply_profile)
+  const char* source = 0; //Start of the body in the source code, while the body hasn't been parsed yet (see compile_stream)
+  std::string cacheKey; //Key of the function's code in the in-memory cache, once its body has been compiled and released (see compile_stream)
+  LabelNode entry; //Start of function (target of sibling tail calls)
+  LabelNode reentry; //After stack allocation (target of self tail calls)
   std::string mangled_name;
   std::string& mangle() {
     if(!mangled_name.size()) {
@@ -257,6 +471,10 @@ public:
       ss<<returnType_resolved->type->scope.mangle();
     }
     mangled_name = ss.str();
+    if(compiler_stats && compiler_stats->memory) {
+      compiler_stats->mangledNames++;
+      compiler_stats->mangledBytes+=mangled_name.size();
+    }
     }
     return mangled_name;
   }
@@ -282,9 +500,9 @@ class BinaryExpressionNode:public Expression {
 public:
   char op;
   char op2 = 0; //Second byte of op
+  bool parenthesized;
   Expression* lhs;
   Expression* rhs;
-  bool parenthesized;
   FunctionCallNode* function;
   const char* GetFriendlyOpName() {
     short op = this->op;
@@ -331,6 +549,7 @@ public:
   LabelNode jmp_false;
   LabelNode jmp_end;
   Expression* condition;
+  signed char likely = 0; //Branch taken more often according to the execution profile (1 for the true branch, -1 for the false branch, 0 if unknown)
 IfStatementNode():Node(IfStatement) {
 }
 };
@@ -341,7 +560,7 @@ WhileStatementNode():Node(WhileStatement) {
 }
   Expression* condition;
   ScopeNode scope;
-  Node* initializer;
+  Node* initializer = 0;
   std::vector<Node*> body;
   LabelNode check;
   LabelNode begin; //Beginning of loop
@@ -0,0 +1,138 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Compiler library interface (libvpp)
+
+#ifndef VPP_HEADER
+#define VPP_HEADER
+#include "options.h"
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <stdio.h>
+
+class Node;
+class ScopeNode;
+class FunctionNode;
+class VariableReferenceNode;
+class VParser;
+class Arena;
+class SessionProgram;
+
+class ValidationError {
+public:
+  std::string msg;
+  Node* node = 0; //Node the error was found at (or 0 if the error isn't about a single node)
+};
+
+//Reports an error in the program being compiled.
+//Errors are collected by the Compiler that is running on this thread, or printed if there is none.
+void report(Node* node, const char* format, ...);
+extern thread_local std::vector<ValidationError>* diagnostics; //Errors collected by the Compiler running on this thread
+
+//Compiles programs from memory to linked images. A Compiler can be reused for any number of programs, one at a time;
+//use a Compiler per thread to compile programs in parallel. Each program is compiled on the calling thread (options.jobs is ignored).
+class Compiler {
+public:
+  CompilerOptions options;
+  std::vector<ValidationError> errors; //Errors found in the last program compiled
+  Compiler();
+  Compiler(const Compiler&) = delete;
+  ~Compiler();
+  //Loads a precompiled prelude, which is declared at the start of every program compiled afterwards.
+  //The prelude is loaded and validated once; every program shares its nodes.
+  bool loadPrelude(const char* filename);
+  //Compiles a source buffer. Returns false if the program is invalid.
+  //The nodes referred to by errors remain valid until the next program is compiled.
+  bool compile(const char* filename, const char* source, size_t size, std::vector<unsigned char>& image);
+private:
+  Arena* arena; //Memory of the last program compiled
+  Arena* preludeArena; //Memory of the prelude, which is shared by every program
+  const char* prelude = 0;
+  ScopeNode* preludeScope = 0; //Declarations of the prelude, loaded and validated once
+  std::vector<Node*> preludeDeclarations;
+  std::vector<std::pair<FunctionNode*,FunctionNode*> > preludeOverloads; //Original overload chain of the prelude's functions, which programs extend
+};
+
+//Compiles a program from files on disk again and again, reusing the work done for the parts that didn't change.
+//Each compilation runs on the calling thread (options.jobs is ignored).
+class Session {
+public:
+  CompilerOptions options;
+  std::vector<ValidationError> errors; //Errors found by the last compilation
+  size_t validated = 0; //Number of functions validated by the last compilation
+  bool rebuilt = false; //True if the last compilation rebuilt the whole program
+  Session();
+  Session(const Session&) = delete;
+  ~Session();
+  bool loadPrelude(const char* filename);
+  void addFile(const char* filename);
+  //Compiles the current contents of the files. Returns false if the program is invalid.
+  bool compile(std::vector<unsigned char>& image);
+private:
+  enum {UpdateDone, UpdateFailed, UpdateRebuild};
+  SessionProgram* rebuild(std::vector<std::string>& sources, const CompilerOptions& programOptions);
+  int update(std::vector<std::string>& sources, const CompilerOptions& programOptions);
+  std::vector<std::string> filenames;
+  Arena* arena; //Memory of the current program
+  SessionProgram* program = 0;
+  size_t baseline = 0; //Size of the arena after the last rebuild (including code generation)
+  UnitCache units; //Code of the current program's functions
+  const char* prelude = 0;
+  const unsigned char* preludeData = 0;
+  size_t preludeSize = 0;
+};
+
+//Stages of a compilation, as used by the vpp driver
+
+class SourceFile {
+public:
+  const char* filename;
+  char* code = 0;
+  VParser* parser = 0;
+  std::vector<Node*>* instructions = 0; //Top-level nodes (once parsed)
+  ScopeNode* scope = 0; //Scope of the file's declarations (once parsed)
+  bool skipBodies = false; //Leave the bodies of top-level functions to be parsed one at a time (see parse_body)
+  uint32_t base = 0; //Location of the file's first byte (see Node::location), or 0 if its nodes don't record where they were parsed
+};
+
+//Parses file.code, returning false on a syntax error
+bool parse_source(SourceFile& file);
+
+//Reads and parses files on up to jobs threads
+bool parse_files(std::vector<SourceFile>& files, int jobs);
+//Merges and validates parsed files, after loading the prelude (if any) into a new global scope.
+//Returns the global scope, or 0 if the program is invalid. References to functions made by top-level code are added to references.
+ScopeNode* compile_program(std::vector<SourceFile>& files, const char* prelude, const unsigned char* preludeData, size_t preludeSize, const CompilerOptions& options, std::vector<Node*>& instructions, std::vector<VariableReferenceNode*>* references = 0);
+//Parses the body of a top-level function that was skipped by parse_source
+bool parse_body(SourceFile& file, FunctionNode* function);
+//Validates a function declared in root, after the rest of the program has been validated
+bool validate_function(FunctionNode* function, ScopeNode* root);
+//Optimizes and links a validated program. The image is allocated with malloc.
+unsigned char* compile_image(std::vector<Node*>& instructions, ScopeNode* root, size_t* size, const CompilerOptions& options);
+//Compiles files one function at a time, releasing the tree of each function once its code has been generated.
+//Returns the linked image (allocated with malloc), or 0 if the program is invalid.
+unsigned char* compile_stream(std::vector<SourceFile>& files, const char* prelude, const unsigned char* preludeData, size_t preludeSize, size_t* size, const CompilerOptions& options);
+//Optimizes one file of a validated program, and generates its object file (allocated with malloc)
+unsigned char* compile_object(SourceFile& file, ScopeNode* root, size_t* size, const CompilerOptions& options);
+//Writes the line table of an image compiled from files (see lines.cpp for the format)
+bool write_line_table(std::vector<SourceFile>& files, const LineTable& table, const char* filename);
+//Prints the import table and code of a linked image, described by table (see disasm.cpp). Returns false if table doesn't match the image.
+bool disassemble(const unsigned char* image, size_t size, const LineTable& table, FILE* out);
+//Reads a profile written by an instrumented image, returning false if it can't be read
+bool read_profile(const char* filename, Profile& profile);
+//Attaches the counts in profile to a validated program (see profile.cpp)
+void apply_profile(std::vector<Node*>& instructions, ScopeNode* root, const Profile& profile);
+const unsigned char* map_prelude(const char* filename, size_t* size);
+bool write_prelude(Node** nodes, size_t count, ScopeNode* scope, const char* filename);
+
+#endif
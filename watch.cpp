@@ -0,0 +1,127 @@
+/*
+Copyright 2018 Brian Bosak
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+//Watch mode (--watch)
+//Compiles the input files, then recompiles them whenever one is saved. The program stays in memory between
+//compilations (see Session), and the output file is replaced atomically after each successful compilation.
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "vpp.h"
+
+//Writes the image to a temporary file and renames it over the output, so that readers never see a partial image
+static bool replace_file(const char* filename, const std::vector<unsigned char>& image) {
+  std::string tmp = std::string(filename)+".tmp";
+  FILE* file = fopen(tmp.data(),"wb");
+  if(!file) {
+    printf("%s: Unable to write file\n",tmp.data());
+    return false;
+  }
+  bool written = fwrite(image.data(),1,image.size(),file) == image.size();
+  written &= fclose(file) == 0;
+  if(!written || rename(tmp.data(),filename)) {
+    printf("%s: Unable to write file\n",filename);
+    remove(tmp.data());
+    return false;
+  }
+  return true;
+}
+
+static void build(Session& session, const char* output) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<unsigned char> image;
+  bool compiled = session.compile(image);
+  for(size_t i = 0;i<session.errors.size();i++) {
+    printf("%s\n",session.errors[i].msg.data());
+  }
+  if(!compiled || !replace_file(output,image)) {
+    printf("Compilation failed\n");
+  }else {
+    double ms = std::chrono::duration<double,std::milli>(std::chrono::steady_clock::now()-start).count();
+    printf("Compiled %s (%zu functions validated%s) in %.1f ms\n",output,session.validated,session.rebuilt ? ", rebuilt" : "",ms);
+  }
+  fflush(stdout);
+}
+
+//Reads the pending events. Returns 1 if any of them is about a watched file, 0 if not, or -1 on error.
+static int read_events(int fd, std::map<int,std::string>& dirs, std::set<std::string>& watched) {
+  alignas(inotify_event) char buffer[4096];
+  ssize_t len = read(fd,buffer,sizeof(buffer));
+  if(len<=0) {
+    return -1;
+  }
+  int changed = 0;
+  for(char* ptr = buffer;ptr<buffer+len;) {
+    inotify_event* event = (inotify_event*)ptr;
+    if(event->len && watched.find(dirs[event->wd]+event->name) != watched.end()) {
+      changed = 1;
+    }
+    ptr+=sizeof(inotify_event)+event->len;
+  }
+  return changed;
+}
+
+int watch(const std::vector<const char*>& filenames, const char* output, const char* prelude, const CompilerOptions& options) {
+  Session session;
+  session.options = options;
+  if(prelude && !session.loadPrelude(prelude)) {
+    return 1;
+  }
+  int fd = inotify_init1(IN_CLOEXEC);
+  if(fd<0) {
+    printf("Unable to watch files: %s\n",strerror(errno));
+    return 1;
+  }
+  //Editors often save by renaming a new file over the old one, so the directories are watched rather than the files
+  std::map<int,std::string> dirs; //Watched directories (with a trailing slash), by watch descriptor
+  std::set<std::string> watched; //Paths of the input files
+  for(size_t i = 0;i<filenames.size();i++) {
+    session.addFile(filenames[i]);
+    std::string path = filenames[i];
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0,slash+1);
+    int wd = inotify_add_watch(fd,dir.size() ? dir.data() : ".",IN_CLOSE_WRITE | IN_MOVED_TO);
+    if(wd<0) {
+      printf("%s: Unable to watch file: %s\n",filenames[i],strerror(errno));
+      return 1;
+    }
+    dirs[wd] = dir;
+    watched.insert(path);
+  }
+  build(session,output);
+  while(true) {
+    int changed = read_events(fd,dirs,watched);
+    if(changed<0 && errno != EINTR) {
+      printf("Unable to watch files: %s\n",strerror(errno));
+      return 1;
+    }
+    if(changed<=0) {
+      continue;
+    }
+    //Saving several files (or one file in several steps) produces a burst of events, which is compiled once
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while(poll(&pfd,1,50)>0) {
+      read_events(fd,dirs,watched);
+    }
+    build(session,output);
+  }
+}